@@ -25,10 +25,14 @@
 
 #include <dbustl-1/EventLoopIntegration>
 #include <dbustl-1/DBusException>
+#include <dbustl-1/MessageLog>
 
 #include <dbustl-1/Connection>
 
 #include <cassert>
+#include <cstring>
+
+#include <errno.h>
 
 namespace dbustl {
 
@@ -74,7 +78,7 @@ DBusConnection* Connection::dbus()
     return _llconn;
 }
 
-Connection::Connection(DBusBusType busType) : _eventLoop(0), _isPrivate(false)
+Connection::Connection(DBusBusType busType) : _eventLoop(0), _isPrivate(false), _watchdog(0), _recorder(0)
 {
     construct(busType);
 
@@ -85,7 +89,7 @@ Connection::Connection(DBusBusType busType) : _eventLoop(0), _isPrivate(false)
 }
 
 Connection::Connection(DBusBusType busType, const EventLoopIntegration& eventLoop) : 
-  _eventLoop(eventLoop.clone()), _isPrivate(false)
+  _eventLoop(eventLoop.clone()), _isPrivate(false), _watchdog(0), _recorder(0)
 {
     construct(busType);
 
@@ -157,8 +161,69 @@ int Connection::busReleaseName(const std::string& name, DBusException *error)
     return -1;
 }
 
+bool Connection::startRecording(const std::string& fileName, DBusException *error)
+{
+    DBusException e;
+
+    stopRecording();
+
+    if(isConnected()) {
+        MessageLogWriter *recorder = new MessageLogWriter;
+        if(!recorder->open(fileName)) {
+            e = DBusException("org.dbustl.RecordingError", 
+                "Unable to open " + fileName + ": " + strerror(errno));
+            delete recorder;
+        }
+        else if(!dbus_connection_add_filter(_llconn, recordFilter, this, NULL)) {
+            e = DBusException(DBUS_ERROR_NO_MEMORY, "Not enough memory to install recording filter");
+            delete recorder;
+        }
+        else {
+            _recorder = recorder;
+            return true;
+        }
+    }
+    else {
+        e = DBusException(DBUS_ERROR_DISCONNECTED, "Connection is closed");
+    }
+
+    if(error) {
+        *error = e;
+    }
+    else {
+    #ifndef DBUSTL_NO_EXCEPTIONS
+        throw e;
+    #endif
+    }
+    return false;
+}
+
+void Connection::stopRecording()
+{
+    if(_recorder) {
+        dbus_connection_remove_filter(_llconn, recordFilter, this);
+        delete _recorder;
+        _recorder = 0;
+    }
+}
+
+void Connection::recordMessageImpl(DBusMessage *msg, bool sent)
+{
+    if(msg) {
+        _recorder->append(msg, sent);
+    }
+}
+
+DBusHandlerResult Connection::recordFilter(DBusConnection *, DBusMessage *msg, void *user_data)
+{
+    //Replies to pending calls never go through filters: ObjectProxy records them itself
+    static_cast<Connection *>(user_data)->recordMessage(msg, false);
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
 Connection::~Connection()
 {
+    stopRecording();
     delete _eventLoop;
     dbus_connection_close(_llconn);
     dbus_connection_unref(_llconn);
@@ -0,0 +1,373 @@
+/*
+ *  DBusTL - D-Bus Template Library
+ *
+ *  Copyright (C) 2008, 2009  Fabien Chevalier <chefabien@gmail.com>
+ *
+ *
+ *  This file is part of the D-Bus Template Library.
+ *
+ *  The D-Bus Template Library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  D-Bus Template Library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with D-Bus Template Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <dbustl-1/types/Convert>
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(DBUSTL_NO_SIMD)
+#define DBUSTL_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace dbustl {
+namespace types {
+
+/* Scalar versions, also used for the tail of the vectorized ones */
+
+template<typename D, typename S>
+static inline void convertScalar(D *dst, const S *src, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) {
+        dst[i] = src[i];
+    }
+}
+
+static inline void convertScalar(bool *dst, const dbus_uint32_t *src, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) {
+        dst[i] = src[i] != 0;
+    }
+}
+
+static inline void interleaveScalar(char *rows, const char *column, size_t ncols, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) {
+        memcpy(rows + i * ncols * 8, column + i * 8, 8);
+    }
+}
+
+static inline void deinterleaveScalar(char *column, const char *rows, size_t ncols, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) {
+        memcpy(column + i * 8, rows + i * ncols * 8, 8);
+    }
+}
+
+#ifdef DBUSTL_X86_SIMD
+
+enum SimdLevel { SimdNone, SimdSSE2, SimdAVX2 };
+
+static SimdLevel simdLevel()
+{
+    static int level = -1;
+    if(level < 0) {
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2")) {
+            level = SimdAVX2;
+        }
+        else if(__builtin_cpu_supports("sse2")) {
+            level = SimdSSE2;
+        }
+        else {
+            level = SimdNone;
+        }
+    }
+    return static_cast<SimdLevel>(level);
+}
+
+/* float <-> double */
+
+__attribute__((target("avx2")))
+static void floatToDoubleAVX2(double *dst, const float *src, size_t n)
+{
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m256 f = _mm256_loadu_ps(src + i);
+        _mm256_storeu_pd(dst + i, _mm256_cvtps_pd(_mm256_castps256_ps128(f)));
+        _mm256_storeu_pd(dst + i + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(f, 1)));
+    }
+    convertScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void floatToDoubleSSE2(double *dst, const float *src, size_t n)
+{
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m128 f = _mm_loadu_ps(src + i);
+        _mm_storeu_pd(dst + i, _mm_cvtps_pd(f));
+        _mm_storeu_pd(dst + i + 2, _mm_cvtps_pd(_mm_movehl_ps(f, f)));
+    }
+    convertScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void doubleToFloatAVX2(float *dst, const double *src, size_t n)
+{
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m128 lo = _mm256_cvtpd_ps(_mm256_loadu_pd(src + i));
+        __m128 hi = _mm256_cvtpd_ps(_mm256_loadu_pd(src + i + 4));
+        _mm256_storeu_ps(dst + i, _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1));
+    }
+    convertScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void doubleToFloatSSE2(float *dst, const double *src, size_t n)
+{
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(src + i));
+        __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(src + i + 2));
+        _mm_storeu_ps(dst + i, _mm_movelh_ps(lo, hi));
+    }
+    convertScalar(dst + i, src + i, n - i);
+}
+
+/* bool <-> dbus_bool_t: bool values are stored as 0 or 1 bytes */
+
+__attribute__((target("avx2")))
+static void boolToWireAVX2(dbus_uint32_t *dst, const bool *src, size_t n)
+{
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m128i b = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_cvtepu8_epi32(b));
+    }
+    convertScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void boolToWireSSE2(dbus_uint32_t *dst, const bool *src, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i lo = _mm_unpacklo_epi8(b, zero);
+        __m128i hi = _mm_unpackhi_epi8(b, zero);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 12), _mm_unpackhi_epi16(hi, zero));
+    }
+    convertScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void wireToBoolAVX2(bool *dst, const dbus_uint32_t *src, size_t n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi32(1);
+    //Packing works within 128 bits lanes: this puts the 32 bits words back in order
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32) {
+        __m256i v[4];
+        for(int k = 0; k < 4; ++k) {
+            __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 8 * k));
+            v[k] = _mm256_andnot_si256(_mm256_cmpeq_epi32(w, zero), one);
+        }
+        __m256i w16a = _mm256_packs_epi32(v[0], v[1]);
+        __m256i w16b = _mm256_packs_epi32(v[2], v[3]);
+        __m256i w8 = _mm256_packus_epi16(w16a, w16b);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_permutevar8x32_epi32(w8, order));
+    }
+    convertScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void wireToBoolSSE2(bool *dst, const dbus_uint32_t *src, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi32(1);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m128i v[4];
+        for(int k = 0; k < 4; ++k) {
+            __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 4 * k));
+            v[k] = _mm_andnot_si128(_mm_cmpeq_epi32(w, zero), one);
+        }
+        __m128i w8 = _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), w8);
+    }
+    convertScalar(dst + i, src + i, n - i);
+}
+
+/* signed char <-> int16 */
+
+__attribute__((target("avx2")))
+static void int8ToInt16AVX2(int16_t *dst, const signed char *src, size_t n)
+{
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_cvtepi8_epi16(b));
+    }
+    convertScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void int8ToInt16SSE2(int16_t *dst, const signed char *src, size_t n)
+{
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        //Byte in the upper half of each 16 bits word, then arithmetic shift to sign extend
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_srai_epi16(_mm_unpacklo_epi8(b, b), 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 8), _mm_srai_epi16(_mm_unpackhi_epi8(b, b), 8));
+    }
+    convertScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void int16ToInt8AVX2(signed char *dst, const int16_t *src, size_t n)
+{
+    //Values are truncated, as a C++ conversion does
+    const __m256i mask = _mm256_set1_epi16(0xff);
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i)), mask);
+        __m256i b = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 16)), mask);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), 
+            _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8));
+    }
+    convertScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void int16ToInt8SSE2(signed char *dst, const int16_t *src, size_t n)
+{
+    const __m128i mask = _mm_set1_epi16(0xff);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m128i a = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i)), mask);
+        __m128i b = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 8)), mask);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(a, b));
+    }
+    convertScalar(dst + i, src + i, n - i);
+}
+
+/* 8 bytes columns <-> rows: columns are handled two by two, two rows at a time */
+
+__attribute__((target("sse2")))
+static void interleavePairSSE2(char *rows, const char *column1, const char *column2, size_t ncols, size_t n)
+{
+    size_t i = 0;
+    for(; i + 2 <= n; i += 2) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(column1 + i * 8));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(column2 + i * 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(rows + i * ncols * 8), _mm_unpacklo_epi64(a, b));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(rows + (i + 1) * ncols * 8), _mm_unpackhi_epi64(a, b));
+    }
+    interleaveScalar(rows + i * ncols * 8, column1 + i * 8, ncols, n - i);
+    interleaveScalar(rows + i * ncols * 8 + 8, column2 + i * 8, ncols, n - i);
+}
+
+__attribute__((target("sse2")))
+static void deinterleavePairSSE2(char *column1, char *column2, const char *rows, size_t ncols, size_t n)
+{
+    size_t i = 0;
+    for(; i + 2 <= n; i += 2) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows + i * ncols * 8));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows + (i + 1) * ncols * 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(column1 + i * 8), _mm_unpacklo_epi64(a, b));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(column2 + i * 8), _mm_unpackhi_epi64(a, b));
+    }
+    deinterleaveScalar(column1 + i * 8, rows + i * ncols * 8, ncols, n - i);
+    deinterleaveScalar(column2 + i * 8, rows + i * ncols * 8 + 8, ncols, n - i);
+}
+
+#define DBUSTL_DISPATCH(avx2, sse2) \
+    switch(simdLevel()) { \
+    case SimdAVX2: avx2(dst, src, n); return; \
+    case SimdSSE2: sse2(dst, src, n); return; \
+    default: break; \
+    }
+
+#else
+
+#define DBUSTL_DISPATCH(avx2, sse2)
+
+#endif /* DBUSTL_X86_SIMD */
+
+void __wireConvert(double *dst, const float *src, size_t n)
+{
+    DBUSTL_DISPATCH(floatToDoubleAVX2, floatToDoubleSSE2)
+    convertScalar(dst, src, n);
+}
+
+void __wireConvert(float *dst, const double *src, size_t n)
+{
+    DBUSTL_DISPATCH(doubleToFloatAVX2, doubleToFloatSSE2)
+    convertScalar(dst, src, n);
+}
+
+void __wireConvert(dbus_uint32_t *dst, const bool *src, size_t n)
+{
+    DBUSTL_DISPATCH(boolToWireAVX2, boolToWireSSE2)
+    convertScalar(dst, src, n);
+}
+
+void __wireConvert(bool *dst, const dbus_uint32_t *src, size_t n)
+{
+    DBUSTL_DISPATCH(wireToBoolAVX2, wireToBoolSSE2)
+    convertScalar(dst, src, n);
+}
+
+void __wireConvert(int16_t *dst, const signed char *src, size_t n)
+{
+    DBUSTL_DISPATCH(int8ToInt16AVX2, int8ToInt16SSE2)
+    convertScalar(dst, src, n);
+}
+
+void __wireConvert(signed char *dst, const int16_t *src, size_t n)
+{
+    DBUSTL_DISPATCH(int16ToInt8AVX2, int16ToInt8SSE2)
+    convertScalar(dst, src, n);
+}
+
+void __wireInterleave64(char *rows, const char * const *columns, size_t ncols, size_t n)
+{
+    size_t c = 0;
+#ifdef DBUSTL_X86_SIMD
+    if(simdLevel() >= SimdSSE2) {
+        for(; c + 2 <= ncols; c += 2) {
+            interleavePairSSE2(rows + c * 8, columns[c], columns[c + 1], ncols, n);
+        }
+    }
+#endif
+    for(; c < ncols; ++c) {
+        interleaveScalar(rows + c * 8, columns[c], ncols, n);
+    }
+}
+
+void __wireDeinterleave64(char * const *columns, const char *rows, size_t ncols, size_t n)
+{
+    size_t c = 0;
+#ifdef DBUSTL_X86_SIMD
+    if(simdLevel() >= SimdSSE2) {
+        for(; c + 2 <= ncols; c += 2) {
+            deinterleavePairSSE2(columns[c], columns[c + 1], rows + c * 8, ncols, n);
+        }
+    }
+#endif
+    for(; c < ncols; ++c) {
+        deinterleaveScalar(columns[c], rows + c * 8, ncols, n);
+    }
+}
+
+}
+}
@@ -25,12 +25,22 @@
 
 #include <dbustl-1/DBusObject>
 #include <dbustl-1/Connection>
+#include <dbustl-1/DispatchWatchdog>
 #include <dbustl-1/Message>
 #include <dbustl-1/types/Basic> //Required for std::string serialization
 
+#include "Probes.h"
+
 #include <set>
 
 #include <cassert>
+#include <cstring>
+
+DBUSTL_PROBE_DEFINE(method__dispatch__entry)
+DBUSTL_PROBE_DEFINE(method__dispatch__exit)
+DBUSTL_PROBE_DEFINE(method__reply)
+DBUSTL_PROBE_DEFINE(signal__create)
+DBUSTL_PROBE_DEFINE(signal__emit)
 
 namespace dbustl {
 
@@ -46,7 +56,8 @@ DBusObjectPathVTable DBusObject::_vtable = {
 std::set<const DBusObject*> DBusObject::_objects;
 
 DBusObject::DBusObject(const std::string& objectPath, const std::string& interface, Connection *conn) 
- : _conn(0), _interface(interface)
+ : _conn(0), _interface(interface), _outOfBandThreshold(0),
+   _outOfBandLimit(DBUS_MAXIMUM_ARRAY_LENGTH)
 {
     // We call setPath() here instead of a direct assignation because setPath() performs
     // a trailing slash check
@@ -132,6 +143,20 @@ void DBusObject::exportMethodInternal(const std::string& methodName, MethodExecu
     _exportedMethods.insert(std::make_pair(methodName, executor));
 }
 
+void DBusObject::unexportMethod(const std::string& methodName, const std::string& interface)
+{
+    const std::string& intf = interface.empty() ? _interface : interface;
+    MethodContainerType::iterator firstMatch = _exportedMethods.lower_bound(methodName);
+    MethodContainerType::iterator lastMatch = _exportedMethods.upper_bound(methodName);
+    
+    for(; (firstMatch != lastMatch) && (firstMatch->second->interface() != intf); ++firstMatch) {};
+    if(firstMatch != lastMatch) {
+        MethodExecutorBase* match = firstMatch->second;
+        _exportedMethods.erase(firstMatch);
+        delete match;
+    }
+}
+
 DBusHandlerResult DBusObject::incomingMessagesProcessing(DBusConnection *, 
     DBusMessage *dbusMessage, void *user_data)
 {   
@@ -141,6 +166,9 @@ DBusHandlerResult DBusObject::incomingMessagesProcessing(DBusConnection *,
          * once it is not used anymore. Ref it one more time as a workaround. */
         dbus_message_ref(dbusMessage);
         
+        DBUSTL_PROBE_MESSAGE(method__dispatch__entry, dbusMessage, true);
+
+        DBusHandlerResult result = DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
         Message call(dbusMessage);
         std::string methodName = call.member();
         std::string interface = call.interface();
@@ -168,9 +196,14 @@ DBusHandlerResult DBusObject::incomingMessagesProcessing(DBusConnection *,
         }
             
         if(executor && 
-            (convertSignature(executor->inSignatures()) 
-                == dbus_message_get_signature(call.dbus()))
+            signatureMatches(executor->inSignatures(), dbus_message_get_signature(call.dbus()), 
+                object->outOfBandLimit(methodName.c_str()) != 0)
             ) {
+            call.setOutOfBandLimit(object->outOfBandLimit(methodName.c_str()));
+            DispatchWatchdog *watchdog = object->_conn->dispatchWatchdog();
+            if(watchdog) {
+                watchdog->dispatchBegin();
+            }
         #ifndef DBUSTL_NO_EXCEPTIONS
             try {
         #endif
@@ -199,14 +232,17 @@ DBusHandlerResult DBusObject::incomingMessagesProcessing(DBusConnection *,
                 }
             }
         #endif
+            if(watchdog) {
+                watchdog->dispatchEnd(dbusMessage);
+            }
       	    //Call is in error state is there was a signature mismatch somewhere
       	    if(!call.error()) {
-      	        return DBUS_HANDLER_RESULT_HANDLED;
-            }
-            else {
-      	        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+      	        result = DBUS_HANDLER_RESULT_HANDLED;
             }
         }
+
+        DBUSTL_PROBE_MESSAGE(method__dispatch__exit, dbusMessage, true);
+        return result;
     }
   	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
@@ -218,6 +254,8 @@ void DBusObject::sendReply(Message& reply)
         (dbus_message_get_type(reply.dbus()) == DBUS_MESSAGE_TYPE_ERROR)
         );
     dbus_connection_send(_conn->dbus(), reply.dbus(), NULL);
+    DBUSTL_PROBE_MESSAGE(method__reply, reply.dbus(), true);
+    _conn->recordMessage(reply.dbus(), true);
 }
 
 void DBusObject::exportSignal(const std::string& name, 
@@ -247,6 +285,8 @@ Message DBusObject::createSignal(const std::string& signalName, const std::strin
     if(signal.dbus()) {
         // Blank out error status
         errorReset();
+        signal.setOutOfBandThreshold(outOfBandThreshold(signalName.c_str()));
+        DBUSTL_PROBE_MESSAGE(signal__create, signal.dbus(), false);
     }
     else {
         throw_or_set(DBUS_ERROR_NO_MEMORY, "Not enough memory to allocate D-Bus message");
@@ -256,6 +296,45 @@ Message DBusObject::createSignal(const std::string& signalName, const std::strin
 }
 
 void DBusObject::emitSignal(Message& signal)
+{
+    if(checkSignal(signal)) {
+        sendSignal(signal);
+    }
+}
+
+void DBusObject::emitSignalTo(const std::string& destination, Message& signal)
+{
+    if(signal.dbus() && !signal.error() && !dbus_message_set_destination(signal.dbus(), destination.c_str())) {
+        throw_or_set(DBUS_ERROR_NO_MEMORY, "Not enough memory to allocate D-Bus message");
+        return;
+    }
+    emitSignal(signal);
+}
+
+void DBusObject::emitSignalTo(const std::vector<std::string>& destinations, Message& signal)
+{
+    if(!checkSignal(signal)) {
+        return;
+    }
+    //Copies are all made first, so that running out of memory sends nothing rather than
+    //leaving the caller to guess which destinations got the signal
+    std::vector<Message> copies;
+    copies.reserve(destinations.size());
+    std::vector<std::string>::const_iterator it;
+    for(it = destinations.begin(); it != destinations.end(); ++it) {
+        //The copy shares nothing with signal, but its body is copied as is
+        copies.push_back(Message(dbus_message_copy(signal.dbus())));
+        if(!copies.back().dbus() || !dbus_message_set_destination(copies.back().dbus(), it->c_str())) {
+            throw_or_set(DBUS_ERROR_NO_MEMORY, "Not enough memory to allocate D-Bus message");
+            return;
+        }
+    }
+    for(size_t i = 0; i < copies.size(); ++i) {
+        sendSignal(copies[i]);
+    }
+}
+
+bool DBusObject::checkSignal(Message& signal)
 {
     if(!signal.error()) {
         const std::string intf = signal.interface();
@@ -267,7 +346,8 @@ void DBusObject::emitSignal(Message& signal)
         for(cur = begin; cur != end; ++cur) {
             const ExportedSignal& signalInfo = cur->second;
             if(signalInfo.interface() == intf) {
-                if(convertSignature(signalInfo.signatures()) == dbus_message_get_signature(signal.dbus())) {
+                if(signatureMatches(signalInfo.signatures(), dbus_message_get_signature(signal.dbus()), 
+                    signal.outOfBandThreshold() != 0)) {
                     match_found = true;
                 }
                 else {
@@ -276,13 +356,13 @@ void DBusObject::emitSignal(Message& signal)
                         + convertSignature(signalInfo.signatures())
                         + "' vs '" + dbus_message_get_signature(signal.dbus()) + "'";
                     throw_or_set("org.dbustl.SignalSignatureMismatch", msg.c_str());
-                    return;
+                    return false;
                 }
             }
         }
     
         if(match_found) {    
-            dbus_connection_send(_conn->dbus(), signal.dbus(), NULL);
+            return true;
         }
         else {
             std::string msg = std::string("Signal \"") + signal.member() + 
@@ -293,6 +373,20 @@ void DBusObject::emitSignal(Message& signal)
     else {
         throw_or_set(*signal.error());
     }
+    return false;
+}
+
+void DBusObject::sendSignal(Message& signal)
+{
+    if(!signal.error()) {
+        errorReset();
+        dbus_connection_send(_conn->dbus(), signal.dbus(), NULL);
+        DBUSTL_PROBE_MESSAGE(signal__emit, signal.dbus(), true);
+        _conn->recordMessage(signal.dbus(), true);
+    }
+    else {
+        throw_or_set(*signal.error());
+    }
 }
 
 std::string DBusObject::introspect()
@@ -394,10 +488,54 @@ std::string DBusObject::convertSignature(const char *const *sig)
     return s;
 }
 
+bool DBusObject::signatureMatches(const char *const *expected, const char *signature, bool outOfBand)
+{
+    for(int i = 0; expected[i]; ++i) {
+        size_t len = strlen(expected[i]);
+        if(strncmp(signature, expected[i], len) == 0) {
+            signature += len;
+        }
+    #ifdef DBUS_TYPE_UNIX_FD
+        //An array of numbers sent out of band, see Message::setOutOfBandThreshold()
+        else if(outOfBand && *signature == DBUS_TYPE_UNIX_FD && expected[i][0] == DBUS_TYPE_ARRAY 
+            && len == 2 && strchr("ynqiuxtd", expected[i][1])) {
+            ++signature;
+        }
+    #endif
+        else {
+            return false;
+        }
+    }
+    return *signature == 0;
+}
+
+size_t DBusObject::outOfBandThreshold(const char *member) const
+{
+#ifdef DBUS_TYPE_UNIX_FD
+    if(!_outOfBandThreshold && _outOfBandThresholds.empty()) {
+        return 0;
+    }
+    if(!_conn || !dbus_connection_can_send_type(_conn->dbus(), DBUS_TYPE_UNIX_FD)) {
+        return 0;
+    }
+    std::map<std::string, size_t>::const_iterator it = _outOfBandThresholds.find(member);
+    return it != _outOfBandThresholds.end() ? it->second : _outOfBandThreshold;
+#else
+    (void)member;
+    return 0;
+#endif
+}
+
+size_t DBusObject::outOfBandLimit(const char *member) const
+{
+    return outOfBandThreshold(member) ? _outOfBandLimit : 0;
+}
+
 void DBusObject::EasyMethodExecutorBase::processCall(DBusObject *object, Message* method_call)
 {
     Message mreturn(method_call->createMethodReturn());
     if(mreturn.dbus()) {
+        mreturn.setOutOfBandThreshold(object->outOfBandThreshold(dbus_message_get_member(method_call->dbus())));
         processCall(method_call, &mreturn);
         if(!method_call->error()) {
             object->sendReply(mreturn);
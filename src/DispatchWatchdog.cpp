@@ -0,0 +1,99 @@
+/*
+ *  DBusTL - D-Bus Template Library
+ *
+ *  Copyright (C) 2008, 2009  Fabien Chevalier <chefabien@gmail.com>
+ *
+ *
+ *  This file is part of the D-Bus Template Library.
+ *
+ *  The D-Bus Template Library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  D-Bus Template Library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with D-Bus Template Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <dbustl-1/DispatchWatchdog>
+
+#include <iostream>
+
+#include <time.h>
+
+namespace dbustl {
+
+static unsigned long long monotonicTimeUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+DispatchWatchdog::DispatchWatchdog(unsigned long thresholdUs) : _threshold(thresholdUs), _depth(0)
+{
+    reset();
+}
+
+DispatchWatchdog::~DispatchWatchdog()
+{
+}
+
+void DispatchWatchdog::stalled(const char *path, const char *interface, const char *member,
+    unsigned long durationUs)
+{
+    std::cerr << "DBusTL: handler for " << path << " " << interface << "." << member
+        << " blocked dispatch for " << durationUs << "us" << std::endl;
+}
+
+void DispatchWatchdog::reset()
+{
+    _count = 0;
+    for(int i = 0; i < HistogramSize; ++i) {
+        _histogram[i] = 0;
+    }
+    _maxDuration = 0;
+    _totalDuration = 0;
+}
+
+void DispatchWatchdog::dispatchBegin()
+{
+    if(_depth < MaxDepth) {
+        _start[_depth] = monotonicTimeUs();
+    }
+    ++_depth;
+}
+
+void DispatchWatchdog::dispatchEnd(DBusMessage *msg)
+{
+    if(_depth == 0 || --_depth >= MaxDepth) {
+        return;
+    }
+    unsigned long duration = monotonicTimeUs() - _start[_depth];
+    int bucket = 0;
+
+    while(bucket < HistogramSize - 1 && (duration >> bucket)) {
+        ++bucket;
+    }
+    _histogram[bucket]++;
+    _count++;
+    _totalDuration += duration;
+    if(duration > _maxDuration) {
+        _maxDuration = duration;
+    }
+
+    if(duration > _threshold) {
+        const char *path = dbus_message_get_path(msg);
+        const char *intf = dbus_message_get_interface(msg);
+        const char *member = dbus_message_get_member(msg);
+        stalled(path ? path : "", intf ? intf : "", member ? member : "", duration);
+    }
+}
+
+}
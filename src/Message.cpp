@@ -28,11 +28,17 @@
 #include <sstream>
 
 #include <cassert>
+#include <cstring>
 
 namespace dbustl {
 
+namespace types {
+__thread bool __wireRejected = false;
+}
+
 Message::Message(DBusMessage *msg)
-  : _msg(msg), _serExcept(0), _iteratorInitialized(false), _parsedArguments(0)
+  : _msg(msg), _serExcept(0), _iteratorInitialized(false), _parsedArguments(0), _outOfBandThreshold(0),
+    _outOfBandLimit(0)
 {
 }
 
@@ -45,6 +51,8 @@ Message::Message(const Message& other)
     _serExcept = other._serExcept;
     _iteratorInitialized = other._iteratorInitialized;
     _parsedArguments = other._parsedArguments;
+    _outOfBandThreshold = other._outOfBandThreshold;
+    _outOfBandLimit = other._outOfBandLimit;
 }
 
 Message::~Message()
@@ -72,6 +80,8 @@ Message& Message::operator=(const Message& other) {
     }
     _iteratorInitialized = other._iteratorInitialized;
     _parsedArguments = other._parsedArguments;
+    _outOfBandThreshold = other._outOfBandThreshold;
+    _outOfBandLimit = other._outOfBandLimit;
     _msg = other._msg;
     return *this;
 }
@@ -84,6 +94,8 @@ Message& Message::operator=(DBusMessage *msg) {
     _serExcept = 0;
     _iteratorInitialized = false;
     _parsedArguments = 0;
+    _outOfBandThreshold = 0;
+    _outOfBandLimit = 0;
     _msg = msg;
     return *this;
 }
@@ -190,4 +202,274 @@ Message& Message::operator<<(const char* inarg)
     return *this;
 }
 
+namespace {
+
+/* Writes a D-Bus message header, or just computes its size if buf is NULL */
+class HeaderWriter {
+    public:
+        explicit HeaderWriter(char *buf) : _buf(buf), _pos(0) {}
+
+        size_t pos() const { return _pos; }
+
+        void pad(size_t alignment)
+        {
+            size_t aligned = types::__wireAlign(_pos, alignment);
+            if(_buf) {
+                memset(_buf + _pos, 0, aligned - _pos);
+            }
+            _pos = aligned;
+        }
+
+        void byte(unsigned char b)
+        {
+            if(_buf) {
+                _buf[_pos] = b;
+            }
+            _pos++;
+        }
+
+        void uint32(dbus_uint32_t v)
+        {
+            pad(4);
+            if(_buf) {
+                memcpy(_buf + _pos, &v, 4);
+            }
+            _pos += 4;
+        }
+
+        void uint32At(size_t pos, dbus_uint32_t v)
+        {
+            if(_buf) {
+                memcpy(_buf + pos, &v, 4);
+            }
+        }
+
+        void bytes(const char *data, size_t len)
+        {
+            if(_buf) {
+                memcpy(_buf + _pos, data, len);
+            }
+            _pos += len;
+        }
+
+        //Header fields are (yv) structs
+        void fieldBegin(int code, char type)
+        {
+            pad(8);
+            byte(code);
+            byte(1);
+            byte(type);
+            byte(0);
+        }
+
+        void stringField(int code, char type, const char *value)
+        {
+            if(value) {
+                size_t len = strlen(value);
+                fieldBegin(code, type);
+                uint32(len);
+                bytes(value, len + 1);
+            }
+        }
+
+        void signatureField(const char* const* signature)
+        {
+            size_t len = 0;
+            for(int i = 0; signature[i]; ++i) {
+                len += strlen(signature[i]);
+            }
+            if(len) {
+                fieldBegin(DBUS_HEADER_FIELD_SIGNATURE, DBUS_TYPE_SIGNATURE);
+                byte(len);
+                for(int i = 0; signature[i]; ++i) {
+                    bytes(signature[i], strlen(signature[i]));
+                }
+                byte(0);
+            }
+        }
+
+    private:
+        char *_buf;
+        size_t _pos;
+};
+
+size_t writeHeader(char *buf, DBusMessage *msg, const char* const* signature, size_t bodySize)
+{
+    static const dbus_uint32_t one = 1;
+    HeaderWriter header(buf);
+
+    header.byte(*reinterpret_cast<const char *>(&one) ? DBUS_LITTLE_ENDIAN : DBUS_BIG_ENDIAN);
+    header.byte(dbus_message_get_type(msg));
+    header.byte((dbus_message_get_no_reply(msg) ? DBUS_HEADER_FLAG_NO_REPLY_EXPECTED : 0)
+        | (dbus_message_get_auto_start(msg) ? 0 : DBUS_HEADER_FLAG_NO_AUTO_START)
+#ifdef DBUS_HEADER_FLAG_ALLOW_INTERACTIVE_AUTHORIZATION
+        | (dbus_message_get_allow_interactive_authorization(msg) ? DBUS_HEADER_FLAG_ALLOW_INTERACTIVE_AUTHORIZATION : 0)
+#endif
+        );
+    header.byte(DBUS_MAJOR_PROTOCOL_VERSION);
+    header.uint32(bodySize);
+    //Messages with a null serial are rejected: this one is reset later on
+    header.uint32(1);
+    
+    size_t fieldsLengthPos = header.pos();
+    header.uint32(0);
+    size_t fieldsStart = header.pos();
+    //Fields in the order libdbus writes them in new messages, which come out the same
+    header.stringField(DBUS_HEADER_FIELD_PATH, DBUS_TYPE_OBJECT_PATH, dbus_message_get_path(msg));
+    header.stringField(DBUS_HEADER_FIELD_DESTINATION, DBUS_TYPE_STRING, dbus_message_get_destination(msg));
+    header.stringField(DBUS_HEADER_FIELD_INTERFACE, DBUS_TYPE_STRING, dbus_message_get_interface(msg));
+    header.stringField(DBUS_HEADER_FIELD_MEMBER, DBUS_TYPE_STRING, dbus_message_get_member(msg));
+    header.stringField(DBUS_HEADER_FIELD_ERROR_NAME, DBUS_TYPE_STRING, dbus_message_get_error_name(msg));
+    if(dbus_message_get_reply_serial(msg)) {
+        header.fieldBegin(DBUS_HEADER_FIELD_REPLY_SERIAL, DBUS_TYPE_UINT32);
+        header.uint32(dbus_message_get_reply_serial(msg));
+    }
+    header.stringField(DBUS_HEADER_FIELD_SENDER, DBUS_TYPE_STRING, dbus_message_get_sender(msg));
+    header.signatureField(signature);
+    //No UNIX_FDS field: the message has no argument yet, and wire writers refuse descriptors
+    header.uint32At(fieldsLengthPos, header.pos() - fieldsStart);
+    //Body starts 8 bytes aligned
+    header.pad(8);
+
+    return header.pos();
+}
+
+}
+
+char* Message::wireBegin(const char* const* signature, size_t bodySize, size_t *headerSize)
+{
+    if(!_msg || _serExcept) {
+        return 0;
+    }
+    if(*dbus_message_get_signature(_msg) != 0) {
+        _serExcept = new DBusException("org.dbustl.MethodCallError", 
+            "Arguments can only be marshalled all at once into an empty message");
+        return 0;
+    }
+
+    *headerSize = writeHeader(0, _msg, signature, bodySize);
+    char *buffer = static_cast<char *>(dbus_malloc(*headerSize + bodySize));
+    if(!buffer) {
+        _serExcept = new DBusException(DBUS_ERROR_NO_MEMORY, "Not enough memory to marshal D-Bus message");
+        return 0;
+    }
+    writeHeader(buffer, _msg, signature, bodySize);
+    types::__wireRejected = false;
+    return buffer;
+}
+
+void Message::wireEnd(char *buffer, size_t size)
+{
+    if(types::__wireRejected) {
+        types::__wireRejected = false;
+        dbus_free(buffer);
+        _serExcept = new DBusException("org.dbustl.MethodCallError", 
+            "Unable to marshal arguments: a string holds a NUL character, or a Variant a file descriptor");
+        return;
+    }
+    DBusException e;
+    DBusMessage *demarshalled = dbus_message_demarshal(buffer, size, e.dbus());
+    dbus_free(buffer);
+    if(!demarshalled) {
+        _serExcept = new DBusException("org.dbustl.MethodCallError", 
+            "Unable to marshal arguments: " + e.message());
+        return;
+    }
+
+    //The copy gets a fresh serial when sent, which the demarshalled message would not.
+    //libdbus has no other way to build a message from a body, nor to reset a serial
+    DBusMessage *msg = dbus_message_copy(demarshalled);
+    dbus_message_unref(demarshalled);
+    if(!msg) {
+        _serExcept = new DBusException(DBUS_ERROR_NO_MEMORY, "Not enough memory to marshal D-Bus message");
+        return;
+    }
+    dbus_message_unref(_msg);
+    _msg = msg;
+    //Appending more arguments with operator<< has to start from the new message
+    _iteratorInitialized = false;
+}
+
+const char* Message::wireBodyBegin(const char* const* signature, bool strict, char **blob)
+{
+    if(!_msg || _serExcept) {
+        return 0;
+    }
+    if(_parsedArguments) {
+        if(!strict) {
+            return 0;
+        }
+        _serExcept = new DBusException("org.dbustl.MethodReplyError", 
+            "Arguments can only be unmarshalled all at once, before any other is read");
+        return 0;
+    }
+
+    const char *msgSignature = dbus_message_get_signature(_msg);
+    const char *s = msgSignature;
+    const char* const* arg;
+    for(arg = signature; *arg; ++arg) {
+        size_t len = strlen(*arg);
+        if(strncmp(s, *arg, len) != 0) {
+            break;
+        }
+        s += len;
+    }
+    if(*arg || *s) {
+        if(!strict) {
+            return 0;
+        }
+        std::string expected;
+        for(arg = signature; *arg; ++arg) {
+            expected += *arg;
+        }
+        _serExcept = new DBusException("org.dbustl.MethodReplyError", 
+            "Unable to unmarshal D-Bus values with signature '" + std::string(msgSignature) 
+            + "' into arguments with signature '" + expected + "'");
+        return 0;
+    }
+
+#ifdef DBUS_TYPE_UNIX_FD
+    //The body only holds indexes into the descriptors, which operator>> can get
+    if(dbus_message_contains_unix_fds(_msg)) {
+        return 0;
+    }
+#endif
+    int len;
+    if(!dbus_message_marshal(_msg, blob, &len)) {
+        _serExcept = new DBusException(DBUS_ERROR_NO_MEMORY, "Not enough memory to unmarshal D-Bus message");
+        return 0;
+    }
+    const dbus_uint32_t one = 1;
+    char nativeByteOrder = *reinterpret_cast<const char *>(&one) ? DBUS_LITTLE_ENDIAN : DBUS_BIG_ENDIAN;
+    if((*blob)[0] != nativeByteOrder) {
+        dbus_free(*blob);
+        return 0;
+    }
+    //Body is at the end of the message
+    dbus_uint32_t bodyLength;
+    memcpy(&bodyLength, *blob + 4, 4);
+    types::__wireRejected = false;
+    return *blob + len - bodyLength;
+}
+
+void Message::wireBodyEnd(char *blob, int arguments)
+{
+    dbus_free(blob);
+    _parsedArguments += arguments;
+    //Leave the iterator on the last argument read, as operator>> would
+    if(arguments > 0) {
+        dbus_message_iter_init(_msg, &_it);
+        for(int i = 1; i < arguments; ++i) {
+            dbus_message_iter_next(&_it);
+        }
+        _iteratorInitialized = true;
+    }
+    if(types::__wireRejected) {
+        //operator>> would have stopped at the offending argument, which is not known here
+        _serExcept = new DBusException("org.dbustl.MethodReplyError", 
+            std::string("Unable to unmarshal D-Bus values with signature '") 
+            + dbus_message_get_signature(_msg) + "': duplicate dictionary key");
+    }
+}
+
 }
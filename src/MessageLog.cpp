@@ -0,0 +1,241 @@
+/*
+ *  DBusTL - D-Bus Template Library
+ *
+ *  Copyright (C) 2008, 2009  Fabien Chevalier <chefabien@gmail.com>
+ *
+ *
+ *  This file is part of the D-Bus Template Library.
+ *
+ *  The D-Bus Template Library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  D-Bus Template Library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with D-Bus Template Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <dbustl-1/MessageLog>
+
+#include <cstring>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace dbustl {
+
+static const char logMagic[8] = { 'D', 'B', 'U', 'S', 'T', 'L', 'O', 'G' };
+static const dbus_uint32_t logVersion = 1;
+static const size_t logHeaderSize = 16;
+static const size_t recordHeaderSize = 16;
+//The log file grows by that many bytes at a time
+static const size_t logChunkSize = 1024 * 1024;
+
+static unsigned long long monotonicTimeUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline size_t align8(size_t size)
+{
+    return (size + 7) & ~(size_t)7;
+}
+
+MessageLogWriter::MessageLogWriter() : _fd(-1), _map(0), _mapSize(0), _used(0), _start(0)
+{
+}
+
+MessageLogWriter::~MessageLogWriter()
+{
+    close();
+}
+
+bool MessageLogWriter::open(const std::string& fileName)
+{
+    close();
+
+    _fd = ::open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(_fd == -1) {
+        return false;
+    }
+    if(!reserve(logHeaderSize)) {
+        int err = errno;
+        close();
+        errno = err;
+        return false;
+    }
+    memcpy(_map, logMagic, sizeof(logMagic));
+    memcpy(_map + 8, &logVersion, sizeof(logVersion));
+    memset(_map + 12, 0, 4);
+    _used = logHeaderSize;
+    _start = monotonicTimeUs();
+    return true;
+}
+
+bool MessageLogWriter::reserve(size_t size)
+{
+    if(_used + size <= _mapSize) {
+        return true;
+    }
+
+    size_t newSize = _mapSize;
+    while(newSize < _used + size) {
+        newSize += logChunkSize;
+    }
+    if(ftruncate(_fd, newSize) == -1) {
+        return false;
+    }
+    void *map = mmap(0, newSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if(map == MAP_FAILED) {
+        return false;
+    }
+    if(_map) {
+        munmap(_map, _mapSize);
+    }
+    _map = static_cast<char *>(map);
+    _mapSize = newSize;
+    return true;
+}
+
+bool MessageLogWriter::append(DBusMessage *msg, bool sent)
+{
+    char *marshalled;
+    int len;
+
+    if(!isOpen() || !dbus_message_marshal(msg, &marshalled, &len)) {
+        return false;
+    }
+
+    size_t recordSize = recordHeaderSize + align8(len);
+    if(!reserve(recordSize)) {
+        dbus_free(marshalled);
+        return false;
+    }
+
+    unsigned long long timestamp = monotonicTimeUs() - _start;
+    dbus_uint32_t length = len;
+    char *record = _map + _used;
+    memcpy(record, &timestamp, 8);
+    memcpy(record + 8, &length, 4);
+    record[12] = sent ? 1 : 0;
+    memset(record + 13, 0, 3);
+    memcpy(record + recordHeaderSize, marshalled, len);
+    memset(record + recordHeaderSize + len, 0, recordSize - recordHeaderSize - len);
+    _used += recordSize;
+
+    dbus_free(marshalled);
+    return true;
+}
+
+void MessageLogWriter::close()
+{
+    if(_map) {
+        munmap(_map, _mapSize);
+        _map = 0;
+    }
+    if(_fd != -1) {
+        //Get rid of the unused end of the last chunk
+        if(ftruncate(_fd, _used) == -1) {
+            //Nothing we can do about it: the reader stops on the zeroed tail anyway
+        }
+        ::close(_fd);
+        _fd = -1;
+    }
+    _mapSize = 0;
+    _used = 0;
+}
+
+MessageLogReader::MessageLogReader() : _map(0), _mapSize(0), _pos(0)
+{
+}
+
+MessageLogReader::~MessageLogReader()
+{
+    close();
+}
+
+bool MessageLogReader::open(const std::string& fileName)
+{
+    struct stat st;
+    dbus_uint32_t version;
+
+    close();
+
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if(fd == -1) {
+        return false;
+    }
+    if(fstat(fd, &st) == -1 || (size_t)st.st_size < logHeaderSize) {
+        ::close(fd);
+        return false;
+    }
+    void *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    //The mapping stays valid once the file is closed
+    ::close(fd);
+    if(map == MAP_FAILED) {
+        return false;
+    }
+    _map = static_cast<const char *>(map);
+    _mapSize = st.st_size;
+
+    memcpy(&version, _map + 8, sizeof(version));
+    if(memcmp(_map, logMagic, sizeof(logMagic)) != 0 || version != logVersion) {
+        close();
+        return false;
+    }
+    rewind();
+    return true;
+}
+
+bool MessageLogReader::next(Entry& entry)
+{
+    dbus_uint32_t length;
+
+    if(!_map || _pos + recordHeaderSize > _mapSize) {
+        return false;
+    }
+    const char *record = _map + _pos;
+    memcpy(&entry.timestamp, record, 8);
+    memcpy(&length, record + 8, 4);
+    entry.sent = record[12] != 0;
+    //A zero length can only come from the unused tail of a log that was not properly closed
+    if(length == 0 || _pos + recordHeaderSize + length > _mapSize) {
+        return false;
+    }
+    entry.message = dbus_message_demarshal(record + recordHeaderSize, length, 0);
+    if(!entry.message) {
+        return false;
+    }
+    _pos += recordHeaderSize + align8(length);
+    return true;
+}
+
+void MessageLogReader::rewind()
+{
+    _pos = logHeaderSize;
+}
+
+void MessageLogReader::close()
+{
+    if(_map) {
+        munmap(const_cast<char *>(_map), _mapSize);
+        _map = 0;
+    }
+    _mapSize = 0;
+    _pos = 0;
+}
+
+}
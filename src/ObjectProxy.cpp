@@ -24,11 +24,22 @@
 #include <dbus/dbus.h>
 
 #include <dbustl-1/Connection>
+#include <dbustl-1/DispatchWatchdog>
 #include <dbustl-1/ObjectProxy>
 
+#include "Probes.h"
+
 #include <iostream>
 #include <cassert>
 
+DBUSTL_PROBE_DEFINE(method__call__create)
+DBUSTL_PROBE_DEFINE(method__call)
+DBUSTL_PROBE_DEFINE(method__call__return)
+DBUSTL_PROBE_DEFINE(async__call)
+DBUSTL_PROBE_DEFINE(async__call__completed)
+DBUSTL_PROBE_DEFINE(signal__dispatch__entry)
+DBUSTL_PROBE_DEFINE(signal__dispatch__exit)
+
 namespace dbustl {
 
 DBusObjectPathVTable ObjectProxy::_vtable = {
@@ -41,7 +52,8 @@ DBusObjectPathVTable ObjectProxy::_vtable = {
 };
 
 ObjectProxy::ObjectProxy(Connection* conn, const std::string& path, const std::string& destination) :
-  _conn(conn), _path(path), _destination(destination), _timeout(-1)
+  _conn(conn), _path(path), _destination(destination), _timeout(-1), _outOfBandThreshold(0),
+  _outOfBandLimit(DBUS_MAXIMUM_ARRAY_LENGTH), _fallback(false)
 {
     assert(_conn->isConnected());
     DBusException ex;
@@ -84,6 +96,8 @@ Message ObjectProxy::createMethodCall(const std::string& methodName)
     if(method_call.dbus()) {
         // Blank out error status
         errorReset();
+        method_call.setOutOfBandThreshold(outOfBandThreshold(methodName));
+        DBUSTL_PROBE_MESSAGE(method__call__create, method_call.dbus(), false);
     }
     else {
         throw_or_set(DBUS_ERROR_NO_MEMORY, "Not enough memory to allocate D-Bus message");
@@ -92,16 +106,70 @@ Message ObjectProxy::createMethodCall(const std::string& methodName)
     return method_call;
 }
 
+size_t ObjectProxy::outOfBandThreshold(const std::string& methodName) const
+{
+#ifdef DBUS_TYPE_UNIX_FD
+    if(!_outOfBandThreshold && _outOfBandThresholds.empty()) {
+        return 0;
+    }
+    if(!dbus_connection_can_send_type(_conn->dbus(), DBUS_TYPE_UNIX_FD)) {
+        return 0;
+    }
+    std::map<std::string, size_t>::const_iterator it = _outOfBandThresholds.find(methodName);
+    return it != _outOfBandThresholds.end() ? it->second : _outOfBandThreshold;
+#else
+    (void)methodName;
+    return 0;
+#endif
+}
+
+size_t ObjectProxy::outOfBandLimit(const std::string& member) const
+{
+    return outOfBandThreshold(member) ? _outOfBandLimit : 0;
+}
+
 Message ObjectProxy::call(Message& method_call)
 {
     DBusException error;
+    DBusPendingCall *pending;
     DBusMessage *reply;
-          
-    reply = dbus_connection_send_with_reply_and_block(_conn->dbus(), method_call.dbus(), _timeout, error.dbus());
+
+    /* This is what dbus_connection_send_with_reply_and_block() does, but doing it
+     * by hand gives us a chance to fire the probe once the serial has been assigned */
+    if(dbus_connection_send_with_reply(_conn->dbus(), method_call.dbus(), &pending, _timeout) == FALSE) {
+        throw_or_set(DBUS_ERROR_NO_MEMORY, "Not enough memory to send D-Bus message");
+        return Message(0);
+    }
+    if(!pending) {
+        //we borrowed this one from dbus library, to be in sync with what it would do.
+        throw_or_set(DBUS_ERROR_DISCONNECTED, "Connection is closed");
+        return Message(0);
+    }
+    DBUSTL_PROBE_MESSAGE(method__call, method_call.dbus(), true);
+    _conn->recordMessage(method_call.dbus(), true);
+
+    dbus_pending_call_block(pending);
+    reply = dbus_pending_call_steal_reply(pending);
+    dbus_pending_call_unref(pending);
     if(!reply) {
+        //libdbus makes up an error reply on timeouts and disconnections: this is out of memory
+        throw_or_set(DBUS_ERROR_NO_MEMORY, "Not enough memory to receive D-Bus reply");
+        return Message(0);
+    }
+
+    DBUSTL_PROBE_MESSAGE(method__call__return, reply, true);
+    _conn->recordMessage(reply, false);
+
+    if(dbus_set_error_from_message(error.dbus(), reply)) {
+        dbus_message_unref(reply);
+        reply = 0;
         throw_or_set(error);
     }
-    return Message(reply);
+    Message mreturn(reply);
+    if(reply) {
+        mreturn.setOutOfBandLimit(outOfBandLimit(method_call.member()));
+    }
+    return mreturn;
 }
 
 void ObjectProxy::processInArgs(Message& msg)
@@ -126,9 +194,19 @@ void ObjectProxy::callCompleted(DBusPendingCall *pending, void *user_data)
     MethodCallbackWrapperBase *callback = static_cast<MethodCallbackWrapperBase*>(user_data);
    
     Message reply(dbus_pending_call_steal_reply(pending));
-     
+    reply.setOutOfBandLimit(callback->_outOfBandLimit);
+
+    DBUSTL_PROBE_MESSAGE(async__call__completed, reply.dbus(), true);
+    callback->_conn->recordMessage(reply.dbus(), false);
+
     dbus_set_error_from_message(e.dbus(), reply.dbus());
 
+    //The method call is only kept if a watchdog was there when it was sent
+    DispatchWatchdog *watchdog = callback->_call ? callback->_conn->dispatchWatchdog() : 0;
+    if(watchdog) {
+        watchdog->dispatchBegin();
+    }
+
     //call user function
 #ifndef DBUSTL_NO_EXCEPTIONS
     try {
@@ -141,6 +219,10 @@ void ObjectProxy::callCompleted(DBusPendingCall *pending, void *user_data)
     }
 #endif
 
+    if(watchdog) {
+        watchdog->dispatchEnd(callback->_call);
+    }
+
     dbus_pending_call_unref(pending);
 }
 
@@ -156,6 +238,14 @@ void ObjectProxy::executeAsyncCall(Message& method_call, MethodCallbackWrapperBa
         DBusPendingCall *pending_return;
         if(dbus_connection_send_with_reply(_conn->dbus(), method_call.dbus(), &pending_return, _timeout) == TRUE) {
             if(pending_return) {
+                DBUSTL_PROBE_MESSAGE(async__call, method_call.dbus(), true);
+                _conn->recordMessage(method_call.dbus(), true);
+                wrapper->_conn = _conn;
+                wrapper->_outOfBandLimit = outOfBandLimit(method_call.member());
+                if(_conn->dispatchWatchdog()) {
+                    //Keep the call around so that the watchdog can tell who the callback is for
+                    wrapper->_call = dbus_message_ref(method_call.dbus());
+                }
                 if(dbus_pending_call_set_notify(pending_return, callCompleted, 
                       wrapper, methodCallbackWrapperDelete) == FALSE) {
                     delete wrapper;
@@ -187,34 +277,49 @@ DBusHandlerResult ObjectProxy::signalsProcessingMethod(DBusConnection *,
          * once it is not used anymore. Ref it one more time as a workaround. */
         dbus_message_ref(dbusMessage);
         
+        DBUSTL_PROBE_MESSAGE(signal__dispatch__entry, dbusMessage, true);
+
         Message msg(dbusMessage);
         std::string sigName = msg.member();
-        std::string handlerName;
         ObjectProxy* proxy = static_cast<ObjectProxy *>(user_data);
        
-        //First check if we can have an exact match
-        if(proxy->_signalsHandlers.count(sigName)) {
-            handlerName = sigName;
-        }
-        //Second check for a generic handler
-        else if(proxy->_signalsHandlers.count("")) {
-            handlerName = "";
+        //First check if we can have an exact match, then for a generic handler, which also
+        //gets the signals the filter of the exact match rejects
+        const std::string handlerNames[] = { sigName, "" };
+        SignalCallbackWrapperBase *handler = NULL;
+        for(int i = 0; i < 2 && !handler; ++i) {
+            std::map<std::string, SignalCallbackWrapperBase* >::iterator it = 
+                proxy->_signalsHandlers.find(handlerNames[i]);
+            if(it != proxy->_signalsHandlers.end() && proxy->acceptsSignal(handlerNames[i], dbusMessage)
+                && it->second->accepts(dbusMessage)) {
+                handler = it->second;
+            }
         }
-        else {
+        if(!handler) {
+            DBUSTL_PROBE_MESSAGE(signal__dispatch__exit, dbusMessage, true);
             return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
         }
+        msg.setOutOfBandLimit(proxy->outOfBandLimit(sigName));
         
+        DispatchWatchdog *watchdog = proxy->_conn->dispatchWatchdog();
+        if(watchdog) {
+            watchdog->dispatchBegin();
+        }
     #ifndef DBUSTL_NO_EXCEPTIONS
         try {
     #endif
-            proxy->_signalsHandlers[handlerName]->execute(msg);
+            handler->execute(msg);
     #ifndef DBUSTL_NO_EXCEPTIONS
         }
         catch(...) {
             std::cerr << "DBusTL: exception thrown in signal handler" << std::endl;
         }
     #endif
+        if(watchdog) {
+            watchdog->dispatchEnd(dbusMessage);
+        }
         
+        DBUSTL_PROBE_MESSAGE(signal__dispatch__exit, dbusMessage, true);
     	return DBUS_HANDLER_RESULT_HANDLED;
     }
     else {
@@ -234,20 +339,33 @@ void ObjectProxy::removeSignalHandler(const std::string& signalName)
 }
 
 void ObjectProxy::setWatchSignal(const std::string& signalName, bool enable)
+{
+    setWatchRule(signalMatchRule(signalName), enable);
+}
+
+std::string ObjectProxy::signalMatchRule(const std::string& signalName) const
+{
+    std::map<std::string, SignalFilter>::const_iterator filter = _signalsFilters.find(signalName);
+    if(filter != _signalsFilters.end()) {
+        return filter->second.rule(_path, signalName);
+    }
+
+    std::string match = std::string("type='signal',path='") +  _path + "'";
+        
+    if(signalName.size()) {
+        match = match + ",member='" + signalName + "'";
+    }
+    return match;
+}
+
+void ObjectProxy::setWatchRule(const std::string& match, bool enable)
 {
     if(!_conn->isPrivate()) {
-        std::string match;
         DBusException error;
         
         //Reset global error status
         errorReset();
 
-        match = std::string("type='signal',path='") +  _path + "'";
-        
-        if(signalName.size()) {
-            match = match + ",member='" + signalName + "'";
-        }
-        
         if(enable) {
             dbus_bus_add_match(_conn->dbus(), match.c_str(), error.dbus());
         }
@@ -261,6 +379,83 @@ void ObjectProxy::setWatchSignal(const std::string& signalName, bool enable)
     }
 }
 
+void ObjectProxy::setSignalFilter(const std::string& signalName, const SignalFilter& filter)
+{
+    errorReset();
+    if(!filter.isValid()) {
+        throw_or_set(DBUS_ERROR_INVALID_ARGS, "Signal filters can only match arguments 0 to 63");
+        return;
+    }
+    if(filter.isPathNamespace() && !_fallback) {
+        DBusException ex;
+        dbus_connection_unregister_object_path(_conn->dbus(), _path.c_str());
+        if(!dbus_connection_try_register_fallback(_conn->dbus(), _path.c_str(), &_vtable, this, ex.dbus())) {
+            //If the object path can't be registered back either, no signal comes in anymore:
+            //report that instead
+            DBusException restoreEx;
+            if(!dbus_connection_try_register_object_path(_conn->dbus(), _path.c_str(), &_vtable, this, restoreEx.dbus())) {
+                throw_or_set(restoreEx);
+                return;
+            }
+            throw_or_set(ex);
+            return;
+        }
+        _fallback = true;
+    }
+
+    std::string oldRule = signalMatchRule(signalName);
+    std::map<std::string, SignalFilter>::iterator it = _signalsFilters.find(signalName);
+    bool hadFilter = (it != _signalsFilters.end());
+    SignalFilter oldFilter = hadFilter ? it->second : SignalFilter();
+    if(filter.isNull()) {
+        _signalsFilters.erase(signalName);
+    }
+    else {
+        _signalsFilters[signalName] = filter;
+    }
+
+    std::string newRule = signalMatchRule(signalName);
+    if(_signalsHandlers.count(signalName) && newRule != oldRule) {
+        //Add the new match rule first, so that no signal is missed meanwhile
+#ifndef DBUSTL_NO_EXCEPTIONS
+        try {
+#endif
+            setWatchRule(newRule, true);
+#ifndef DBUSTL_NO_EXCEPTIONS
+        }
+        catch(...) {
+            if(hadFilter) {
+                _signalsFilters[signalName] = oldFilter;
+            }
+            else {
+                _signalsFilters.erase(signalName);
+            }
+            throw;
+        }
+#endif
+        if(DBUSTL_HAS_ERROR()) {
+            if(hadFilter) {
+                _signalsFilters[signalName] = oldFilter;
+            }
+            else {
+                _signalsFilters.erase(signalName);
+            }
+            return;
+        }
+        setWatchRule(oldRule, false);
+    }
+}
+
+bool ObjectProxy::acceptsSignal(const std::string& handlerName, DBusMessage *signal) const
+{
+    std::map<std::string, SignalFilter>::const_iterator filter = _signalsFilters.find(handlerName);
+    if(filter != _signalsFilters.end()) {
+        return filter->second.matches(signal, _path);
+    }
+    //Signals of the objects below our path, for the handlers without pathNamespace()
+    return !_fallback || _path == dbus_message_get_path(signal);
+}
+
 void ObjectProxy::enableSignal(const std::string& signalName, SignalCallbackWrapperBase* signalCb)
 {
     if(!_signalsHandlers.count(signalName)) {
@@ -0,0 +1,114 @@
+/*
+ *  DBusTL - D-Bus Template Library
+ *
+ *  Copyright (C) 2008, 2009  Fabien Chevalier <chefabien@gmail.com>
+ *
+ *
+ *  This file is part of the D-Bus Template Library.
+ *
+ *  The D-Bus Template Library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  D-Bus Template Library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with D-Bus Template Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DBUSTL_PROBES
+#define DBUSTL_PROBES
+
+/* Internal header: USDT (SystemTap / bpftrace / perf) static probes.
+ *
+ * Probes are only compiled in when DBUSTL_ENABLE_PROBES is defined, which is
+ * done by configure --enable-probes. Otherwise all macros below expand to nothing.
+ *
+ * Every probe is "dbustl:<name>" and carries three arguments:
+ *   - arg0: the serial of the method call or signal this event relates to
+ *     (for replies, this is the serial of the call being replied to). It is
+ *     0 for messages that have not been sent yet.
+ *   - arg1: the member name, or error name for error replies, or "" if none.
+ *   - arg2: the size of the message body in bytes, or 0 if the message is still
+ *     being built.
+ *
+ * Each probe has a semaphore, so that the arguments (especially the body size,
+ * which requires walking through the message values) are only computed when a
+ * tracer is actually attached.
+ */
+
+#ifdef DBUSTL_ENABLE_PROBES
+
+#include <dbus/dbus.h>
+#include <dbustl-1/types/Serialization>
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define DBUSTL_PROBE_DEFINE(name) \
+    extern "C" { \
+        volatile unsigned short dbustl_##name##_semaphore __attribute__((section(".probes"))); \
+    }
+
+#define DBUSTL_PROBE_MESSAGE(name, msg, sent) \
+    do { \
+        if(dbustl_##name##_semaphore) { \
+            dbustl::probes::ProbeArgs __args(msg, sent); \
+            DTRACE_PROBE3(dbustl, name, __args.serial, __args.member, __args.size); \
+        } \
+    } while(0)
+
+namespace dbustl {
+namespace probes {
+
+    struct ProbeArgs {
+        //If sent is false, the message may still be under construction,
+        //so its values must not be walked through.
+        ProbeArgs(DBusMessage *msg, bool sent) : serial(0), member(""), size(0)
+        {
+            if(!msg) {
+                return;
+            }
+            switch(dbus_message_get_type(msg)) {
+            case DBUS_MESSAGE_TYPE_METHOD_RETURN:
+                serial = dbus_message_get_reply_serial(msg);
+                break;
+            case DBUS_MESSAGE_TYPE_ERROR:
+                serial = dbus_message_get_reply_serial(msg);
+                member = dbus_message_get_error_name(msg);
+                break;
+            default:
+                serial = dbus_message_get_serial(msg);
+                member = dbus_message_get_member(msg);
+                break;
+            }
+            if(!member) {
+                member = "";
+            }
+            if(sent) {
+                //libdbus does not tell the body length, but it can be computed without copying the body
+                size = types::__wireBodySize(msg);
+            }
+        }
+
+        dbus_uint32_t serial;
+        const char *member;
+        unsigned int size;
+    };
+
+}
+}
+
+#else /* DBUSTL_ENABLE_PROBES */
+
+#define DBUSTL_PROBE_DEFINE(name)
+#define DBUSTL_PROBE_MESSAGE(name, msg, sent) do {} while(0)
+
+#endif /* DBUSTL_ENABLE_PROBES */
+
+#endif /* DBUSTL_PROBES */
@@ -0,0 +1,244 @@
+/*
+ *  DBusTL - D-Bus Template Library
+ *
+ *  Copyright (C) 2008, 2009  Fabien Chevalier <chefabien@gmail.com>
+ *
+ *
+ *  This file is part of the D-Bus Template Library.
+ *
+ *  The D-Bus Template Library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  D-Bus Template Library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with D-Bus Template Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <dbustl-1/types/SharedBuffer>
+
+#ifdef DBUSTL_UNIX_FD
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS)
+#define DBUSTL_HAVE_SEALS
+#endif
+
+namespace dbustl {
+
+#ifdef DBUSTL_HAVE_SEALS
+//Seals without which the receiver could see the buffer change, or get a SIGBUS
+static const int requiredSeals = F_SEAL_SHRINK | F_SEAL_WRITE;
+#endif
+
+//Size of a received memory file, which must have the required seals
+static bool sealedSize(int fd, size_t *size)
+{
+#ifdef DBUSTL_HAVE_SEALS
+    int seals = fcntl(fd, F_GET_SEALS);
+    if(seals < 0 || (seals & requiredSeals) != requiredSeals) {
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0 || st.st_size < 0) {
+        return false;
+    }
+    *size = st.st_size;
+    return true;
+#else
+    (void)fd;
+    (void)size;
+    return false;
+#endif
+}
+
+SharedBuffer::SharedBuffer(size_t size) : _data(NULL), _size(0), _sealed(false)
+{
+#ifdef DBUSTL_HAVE_SEALS
+    UnixFd fd(memfd_create("dbustl-shared-buffer", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+    if(!fd.isValid() || ftruncate(fd.get(), size) < 0) {
+        return;
+    }
+    if(size) {
+        void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd.get(), 0);
+        if(data == MAP_FAILED) {
+            return;
+        }
+        _data = static_cast<char *>(data);
+    }
+    _fd = std::move(fd);
+    _size = size;
+#else
+    (void)size;
+#endif
+}
+
+SharedBuffer::SharedBuffer(const void *data, size_t size) : SharedBuffer(size)
+{
+    if(!isNull()) {
+        if(size) {
+            memcpy(_data, data, size);
+        }
+        if(!seal()) {
+            unmap();
+            _fd.reset();
+        }
+    }
+}
+
+SharedBuffer::SharedBuffer(SharedBuffer&& other) : 
+    _fd(std::move(other._fd)), _data(other._data), _size(other._size), _sealed(other._sealed)
+{
+    other._data = NULL;
+    other._size = 0;
+    other._sealed = false;
+}
+
+SharedBuffer& SharedBuffer::operator=(SharedBuffer&& other)
+{
+    if(this != &other) {
+        unmap();
+        _fd = std::move(other._fd);
+        _data = other._data;
+        _size = other._size;
+        _sealed = other._sealed;
+        other._data = NULL;
+        other._size = 0;
+        other._sealed = false;
+    }
+    return *this;
+}
+
+SharedBuffer::~SharedBuffer()
+{
+    unmap();
+}
+
+void SharedBuffer::unmap()
+{
+    if(_data) {
+        munmap(_data, _size);
+        _data = NULL;
+    }
+    _size = 0;
+    _sealed = false;
+}
+
+bool SharedBuffer::seal()
+{
+    if(isNull()) {
+        return false;
+    }
+    if(_sealed) {
+        return true;
+    }
+#ifdef DBUSTL_HAVE_SEALS
+    //F_SEAL_WRITE is refused as long as a writable shared mapping exists
+    size_t size = _size;
+    if(_data) {
+        munmap(_data, size);
+        _data = NULL;
+    }
+    if(fcntl(_fd.get(), F_ADD_SEALS, requiredSeals | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        unmap();
+        _fd.reset();
+        return false;
+    }
+    if(size) {
+        void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, _fd.get(), 0);
+        if(data == MAP_FAILED) {
+            unmap();
+            _fd.reset();
+            return false;
+        }
+        _data = static_cast<char *>(data);
+    }
+    _sealed = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool SharedBuffer::map(UnixFd&& fd)
+{
+    unmap();
+    _fd.reset();
+    size_t size;
+    if(!sealedSize(fd.get(), &size)) {
+        return false;
+    }
+    if(size) {
+        void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd.get(), 0);
+        if(data == MAP_FAILED) {
+            return false;
+        }
+        _data = static_cast<char *>(data);
+    }
+    _fd = std::move(fd);
+    _size = size;
+    _sealed = true;
+    return true;
+}
+
+namespace types {
+
+bool __writeOutOfBand(DBusMessageIter* it, const void *data, size_t size, dbus_bool_t *ok)
+{
+    SharedBuffer buffer(data, size);
+    if(buffer.isNull()) {
+        return false;
+    }
+    *ok = Serializer<SharedBuffer>::run(it, buffer);
+    return true;
+}
+
+__OutOfBandReader::__OutOfBandReader(DBusMessageIter* it) : _fd(-1), _size(0)
+{
+    UnixFd fd;
+    if(Deserializer<UnixFd>::run(it, &fd) && sealedSize(fd.get(), &_size)) {
+        _fd = fd.release();
+    }
+}
+
+__OutOfBandReader::~__OutOfBandReader()
+{
+    if(_fd >= 0) {
+        close(_fd);
+    }
+}
+
+bool __OutOfBandReader::read(void *buf) const
+{
+    //Reading is cheaper than mapping pages only to copy them once
+    size_t done = 0;
+    while(done < _size) {
+        ssize_t n = pread(_fd, static_cast<char *>(buf) + done, _size - done, done);
+        if(n <= 0) {
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+}
+
+}
+
+#endif /* DBUSTL_UNIX_FD */
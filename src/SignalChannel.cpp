@@ -0,0 +1,374 @@
+/*
+ *  DBusTL - D-Bus Template Library
+ *
+ *  Copyright (C) 2008, 2009  Fabien Chevalier <chefabien@gmail.com>
+ *
+ *
+ *  This file is part of the D-Bus Template Library.
+ *
+ *  The D-Bus Template Library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  D-Bus Template Library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with D-Bus Template Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <dbustl-1/SignalChannel>
+
+#ifdef DBUSTL_UNIX_FD
+
+#include <atomic>
+#include <new>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS)
+#include <sys/eventfd.h>
+#define DBUSTL_HAVE_SIGNAL_CHANNELS
+#endif
+
+namespace dbustl {
+
+static const char *SignalChannelInterface = "org.dbustl.SignalChannel";
+
+/* Head of the memory file shared by the producer and one subscriber, followed by 
+ * capacity records of recordSize bytes. The counters are only ever incremented: record
+ * n is at index n & (capacity - 1). Each side keeps its own counter in private memory,
+ * and only trusts the other one as long as it is consistent. */
+struct __SignalRing {
+    uint32_t recordSize;
+    uint32_t capacity;
+    char pad1[56];
+    //Written by the producer
+    std::atomic<uint64_t> head;
+    char pad2[56];
+    //Written by the subscriber
+    std::atomic<uint64_t> tail;
+    //Set by the subscriber before it sleeps on the eventfd
+    std::atomic<uint32_t> waiting;
+    //Set by the subscriber when it goes away
+    std::atomic<uint32_t> closed;
+    char pad3[48];
+};
+
+static std::string joinSignature(const char *const *signature)
+{
+    std::string s;
+    for(int i = 0; signature[i]; ++i) {
+        s += signature[i];
+    }
+    return s;
+}
+
+struct SignalChannelBase::Ring {
+    UnixFd memFd;
+    UnixFd eventFd;
+    //Read end of a pipe the subscriber keeps the write end of
+    UnixFd hangup;
+    //Unique name of the subscriber connection
+    std::string sender;
+    __SignalRing *shared;
+    size_t mapSize;
+    char *records;
+    uint64_t head;
+
+    Ring() : shared(NULL), mapSize(0), records(NULL), head(0) {}
+    ~Ring()
+    {
+        if(shared) {
+            munmap(shared, mapSize);
+        }
+    }
+
+    bool create(size_t recordSize, size_t capacity)
+    {
+#ifdef DBUSTL_HAVE_SIGNAL_CHANNELS
+        mapSize = sizeof(__SignalRing) + recordSize * capacity;
+        memFd.reset(memfd_create("dbustl-signal-channel", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+        eventFd.reset(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+        if(!memFd.isValid() || !eventFd.isValid() || ftruncate(memFd.get(), mapSize) < 0) {
+            return false;
+        }
+        //The subscriber would get a SIGBUS if we shrank the file
+        if(fcntl(memFd.get(), F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+            return false;
+        }
+        void *data = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, memFd.get(), 0);
+        if(data == MAP_FAILED) {
+            return false;
+        }
+        shared = new(data) __SignalRing();
+        shared->recordSize = recordSize;
+        shared->capacity = capacity;
+        records = static_cast<char *>(data) + sizeof(__SignalRing);
+        return true;
+#else
+        (void)recordSize;
+        (void)capacity;
+        return false;
+#endif
+    }
+
+    //The subscriber said it went away, or its process did
+    bool isClosed() const
+    {
+        if(shared->closed.load(std::memory_order_relaxed)) {
+            return true;
+        }
+        struct pollfd pfd = { hangup.get(), POLLIN, 0 };
+        return poll(&pfd, 1, 0) != 0;
+    }
+};
+
+SignalChannelBase::SignalChannelBase(DBusObject *object, const std::string& signalName, 
+    const std::string& interface, const char *const *signature, size_t recordSize, size_t capacity)
+  : _object(object), _signalName(signalName), _interface(interface), _broadcast(true),
+    _signature(joinSignature(signature)), _recordSize(recordSize), _capacity(1), _dropped(0),
+    _maxChannelsPerPeer(4)
+{
+    while(_capacity < capacity) {
+        _capacity *= 2;
+    }
+    _object->exportMethod(_signalName, this, &SignalChannelBase::open, 
+        SignatureBuilder<std::string, UnixFd>(), SignatureBuilder<UnixFd, UnixFd, uint32_t>(), SignalChannelInterface);
+}
+
+SignalChannelBase::~SignalChannelBase()
+{
+    _object->unexportMethod(_signalName, SignalChannelInterface);
+    for(size_t i = 0; i < _rings.size(); ++i) {
+        delete _rings[i];
+    }
+}
+
+void SignalChannelBase::open(Message call)
+{
+    std::string signature;
+    UnixFd hangup;
+    call >> signature >> hangup;
+    if(call.error()) {
+        return;
+    }
+    if(signature != _signature) {
+        Message reply = call.createErrorReply("org.dbustl.SignalChannel.SignatureMismatch", 
+            "Signal \"" + _signalName + "\" has signature '" + _signature + "', not '" + signature + "'");
+        if(reply.dbus()) {
+            _object->sendReply(reply);
+        }
+        return;
+    }
+    removeClosedRings();
+    const char *sender = dbus_message_get_sender(call.dbus());
+    size_t channels = 0;
+    for(size_t i = 0; sender && i < _rings.size(); ++i) {
+        channels += (_rings[i]->sender == sender);
+    }
+    if(channels >= _maxChannelsPerPeer) {
+        Message reply = call.createErrorReply("org.dbustl.SignalChannel.LimitExceeded", 
+            "Too many channels open for signal \"" + _signalName + "\"");
+        if(reply.dbus()) {
+            _object->sendReply(reply);
+        }
+        return;
+    }
+    Ring *ring = new Ring;
+    ring->hangup = std::move(hangup);
+    ring->sender = sender ? sender : "";
+    Message reply = call.createMethodReturn();
+    if(ring->create(_recordSize, _capacity) && reply.dbus()) {
+        reply << ring->memFd << ring->eventFd << static_cast<uint32_t>(_capacity);
+        if(!reply.error()) {
+            _rings.push_back(ring);
+            _object->sendReply(reply);
+            return;
+        }
+    }
+    delete ring;
+    reply = call.createErrorReply("org.dbustl.SignalChannel.Unavailable", 
+        "Shared memory channels are not available on this connection");
+    if(reply.dbus()) {
+        _object->sendReply(reply);
+    }
+}
+
+void SignalChannelBase::removeClosedRings()
+{
+    size_t i = 0;
+    while(i < _rings.size()) {
+        if(_rings[i]->isClosed()) {
+            delete _rings[i];
+            _rings.erase(_rings.begin() + i);
+        }
+        else {
+            ++i;
+        }
+    }
+}
+
+void SignalChannelBase::publish(const char *record)
+{
+    size_t i = 0;
+    while(i < _rings.size()) {
+        Ring *ring = _rings[i];
+        uint64_t tail = ring->shared->tail.load(std::memory_order_acquire);
+        bool full = tail <= ring->head && ring->head - tail >= _capacity;
+        //A full ring is the one of a subscriber that may have died: polling its pipe only then
+        //keeps the common case free of system calls
+        if(ring->shared->closed.load(std::memory_order_relaxed) || tail > ring->head || (full && ring->isClosed())) {
+            //Gone, or not playing by the rules
+            delete ring;
+            _rings.erase(_rings.begin() + i);
+            continue;
+        }
+        ++i;
+        if(full) {
+            ++_dropped;
+            continue;
+        }
+        memcpy(ring->records + (ring->head & (_capacity - 1)) * _recordSize, record, _recordSize);
+        ++ring->head;
+        //Sequentially consistent, so that either we see the subscriber waiting,
+        //or it sees the new head before it sleeps
+        ring->shared->head.store(ring->head);
+        if(ring->shared->waiting.load() && ring->shared->waiting.exchange(0)) {
+            uint64_t one = 1;
+            if(write(ring->eventFd.get(), &one, sizeof(one)) < 0) {
+                //The counter can only overflow if the subscriber never reads it: nothing to do
+            }
+        }
+    }
+}
+
+SignalChannelReceiverBase::SignalChannelReceiverBase(ObjectProxy *proxy, const std::string& signalName, 
+    const char *const *signature, size_t recordSize)
+  : _proxy(proxy), _signalName(signalName), _ring(NULL), _mapSize(0), _records(NULL), 
+    _recordSize(recordSize), _mask(0), _tail(0), _fallback(false)
+{
+#ifdef DBUSTL_HAVE_SIGNAL_CHANNELS
+    UnixFd memFd, eventFd;
+    uint32_t capacity = 0;
+    int fds[2];
+    if(pipe2(fds, O_CLOEXEC) < 0) {
+        return;
+    }
+    UnixFd hangupReader(fds[0]), hangup(fds[1]);
+#ifndef DBUSTL_NO_EXCEPTIONS
+    try {
+#endif
+        _proxy->call(_signalName, Interface(SignalChannelInterface), joinSignature(signature), hangupReader,
+            &memFd, &eventFd, &capacity);
+#ifndef DBUSTL_NO_EXCEPTIONS
+    }
+    catch(const DBusException&) {
+        return;
+    }
+#else
+    if(_proxy->hasError()) {
+        return;
+    }
+#endif
+    //Check that the file is big enough, and that it can't shrink under our feet
+    struct stat st;
+    int seals = fcntl(memFd.get(), F_GET_SEALS);
+    if(!eventFd.isValid() || capacity == 0 || (capacity & (capacity - 1)) || seals < 0 
+        || !(seals & F_SEAL_SHRINK) || fstat(memFd.get(), &st) < 0 
+        || static_cast<uint64_t>(st.st_size) < sizeof(__SignalRing) + static_cast<uint64_t>(recordSize) * capacity) {
+        return;
+    }
+    size_t mapSize = sizeof(__SignalRing) + recordSize * capacity;
+    void *data = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, memFd.get(), 0);
+    if(data == MAP_FAILED) {
+        return;
+    }
+    __SignalRing *ring = static_cast<__SignalRing *>(data);
+    if(ring->recordSize != recordSize || ring->capacity != capacity) {
+        munmap(data, mapSize);
+        return;
+    }
+    fcntl(eventFd.get(), F_SETFL, O_NONBLOCK);
+    _ring = ring;
+    _mapSize = mapSize;
+    _records = static_cast<const char *>(data) + sizeof(__SignalRing);
+    _mask = capacity - 1;
+    _tail = ring->tail.load(std::memory_order_relaxed);
+    _eventFd = std::move(eventFd);
+    _hangup = std::move(hangup);
+#else
+    (void)signature;
+#endif
+}
+
+SignalChannelReceiverBase::~SignalChannelReceiverBase()
+{
+    if(_ring) {
+        _ring->closed.store(1, std::memory_order_relaxed);
+        munmap(_ring, _mapSize);
+    }
+    if(_fallback) {
+#ifndef DBUSTL_NO_EXCEPTIONS
+        try {
+#endif
+            _proxy->removeSignalHandler(_signalName);
+#ifndef DBUSTL_NO_EXCEPTIONS
+        }
+        catch(const DBusException&) {
+            //Skip exception
+        }
+#endif
+    }
+}
+
+const char *SignalChannelReceiverBase::front()
+{
+    if(!_ring) {
+        return NULL;
+    }
+    uint64_t head = _ring->head.load(std::memory_order_acquire);
+    if(head == _tail || head - _tail > _mask + 1) {
+        return NULL;
+    }
+    return _records + (_tail & _mask) * _recordSize;
+}
+
+void SignalChannelReceiverBase::pop()
+{
+    ++_tail;
+    _ring->tail.store(_tail, std::memory_order_release);
+}
+
+bool SignalChannelReceiverBase::sleep()
+{
+    uint64_t count;
+    if(read(_eventFd.get(), &count, sizeof(count)) < 0) {
+        //Nothing to reset
+    }
+    //Sequentially consistent, see SignalChannelBase::publish()
+    _ring->waiting.store(1);
+    if(_ring->head.load() != _tail) {
+        _ring->waiting.store(0);
+        return false;
+    }
+    return true;
+}
+
+void SignalChannelReceiverBase::setFallback(const std::function<void(Message&)>& handler)
+{
+    _proxy->setSignalHandler(_signalName, handler);
+    _fallback = true;
+}
+
+}
+
+#endif /* DBUSTL_UNIX_FD */
@@ -0,0 +1,127 @@
+/*
+ *  DBusTL - D-Bus Template Library
+ *
+ *  Copyright (C) 2008, 2009  Fabien Chevalier <chefabien@gmail.com>
+ *
+ *
+ *  This file is part of the D-Bus Template Library.
+ *
+ *  The D-Bus Template Library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  D-Bus Template Library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with D-Bus Template Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <dbustl-1/SignalFilter>
+
+#include <cstring>
+#include <sstream>
+
+namespace dbustl {
+
+//Quotes a match rule value: quotes can't be escaped inside quotes, only between them
+static std::string quote(const std::string& value)
+{
+    std::string quoted("'");
+    for(std::string::size_type i = 0; i < value.size(); ++i) {
+        if(value[i] == '\'') {
+            quoted += "'\\''";
+        }
+        else {
+            quoted += value[i];
+        }
+    }
+    return quoted + "'";
+}
+
+//True if name is ns, or below ns with the given separator
+static bool inNamespace(const char *name, const std::string& ns, char separator)
+{
+    size_t len = ns.size();
+    if(strncmp(name, ns.c_str(), len) != 0) {
+        return false;
+    }
+    return name[len] == 0 || name[len] == separator 
+        || (len && ns[len - 1] == separator);
+}
+
+std::string SignalFilter::rule(const std::string& path, const std::string& member) const
+{
+    std::ostringstream rule;
+    rule << "type='signal'";
+    if(!_sender.empty()) {
+        rule << ",sender=" << quote(_sender);
+    }
+    if(!_interface.empty()) {
+        rule << ",interface=" << quote(_interface);
+    }
+    if(!member.empty()) {
+        rule << ",member=" << quote(member);
+    }
+    rule << (_pathNamespace ? ",path_namespace=" : ",path=") << quote(path);
+    std::map<unsigned int, std::string>::const_iterator it;
+    for(it = _args.begin(); it != _args.end(); ++it) {
+        rule << ",arg" << it->first << "=" << quote(it->second);
+    }
+    if(!_arg0Namespace.empty()) {
+        rule << ",arg0namespace=" << quote(_arg0Namespace);
+    }
+    return rule.str();
+}
+
+bool SignalFilter::matches(DBusMessage *signal, const std::string& path) const
+{
+    const char *signalPath = dbus_message_get_path(signal);
+    if(!signalPath) {
+        return false;
+    }
+    if(_pathNamespace ? !inNamespace(signalPath, path, '/') : path != signalPath) {
+        return false;
+    }
+    //Well known names are resolved by the bus daemon
+    const char *sender = dbus_message_get_sender(signal);
+    if(!_sender.empty() && _sender[0] == ':' && sender && _sender != sender) {
+        return false;
+    }
+    if(!_interface.empty()) {
+        const char *interface = dbus_message_get_interface(signal);
+        if(!interface || _interface != interface) {
+            return false;
+        }
+    }
+    if(_args.empty() && _arg0Namespace.empty()) {
+        return true;
+    }
+
+    DBusMessageIter it;
+    dbus_message_iter_init(signal, &it);
+    std::map<unsigned int, std::string>::const_iterator arg = _args.begin();
+    for(unsigned int n = 0; arg != _args.end() || (n == 0 && !_arg0Namespace.empty()); ++n) {
+        const char *value = NULL;
+        if(dbus_message_iter_get_arg_type(&it) == DBUS_TYPE_STRING) {
+            dbus_message_iter_get_basic(&it, &value);
+        }
+        if(n == 0 && !_arg0Namespace.empty() && (!value || !inNamespace(value, _arg0Namespace, '.'))) {
+            return false;
+        }
+        if(arg != _args.end() && arg->first == n) {
+            if(!value || arg->second != value) {
+                return false;
+            }
+            ++arg;
+        }
+        dbus_message_iter_next(&it);
+    }
+    return true;
+}
+
+}
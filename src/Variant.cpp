@@ -0,0 +1,648 @@
+/*
+ *  DBusTL - D-Bus Template Library
+ *
+ *  Copyright (C) 2008, 2009  Fabien Chevalier <chefabien@gmail.com>
+ *
+ *
+ *  This file is part of the D-Bus Template Library.
+ *
+ *  The D-Bus Template Library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  D-Bus Template Library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with D-Bus Template Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <dbustl-1/types/Variant>
+
+#include <algorithm>
+#include <cstring>
+
+namespace dbustl {
+
+using types::__BasicValue;
+using types::__wireAlign;
+using types::__wirePad;
+
+/* Wire size, which is also the alignment, of fixed size basic types */
+static size_t fixedSize(int type)
+{
+    switch(type) {
+    case DBUS_TYPE_BYTE:
+        return 1;
+    case DBUS_TYPE_INT16:
+    case DBUS_TYPE_UINT16:
+        return 2;
+    case DBUS_TYPE_BOOLEAN:
+    case DBUS_TYPE_INT32:
+    case DBUS_TYPE_UINT32:
+        return 4;
+    default:
+        return 8;
+    }
+}
+
+static size_t alignment(int type)
+{
+    switch(type) {
+    case DBUS_TYPE_BYTE:
+    case DBUS_TYPE_SIGNATURE:
+    case DBUS_TYPE_VARIANT:
+        return 1;
+    case DBUS_TYPE_INT16:
+    case DBUS_TYPE_UINT16:
+        return 2;
+    case DBUS_TYPE_INT64:
+    case DBUS_TYPE_UINT64:
+    case DBUS_TYPE_DOUBLE:
+    case DBUS_TYPE_STRUCT:
+    case DBUS_STRUCT_BEGIN_CHAR:
+    case DBUS_TYPE_DICT_ENTRY:
+    case DBUS_DICT_ENTRY_BEGIN_CHAR:
+        return 8;
+    default:
+        return 4;
+    }
+}
+
+/* Works on signature characters too, unlike dbus_type_is_fixed(). File descriptors are left out */
+static bool isFixedType(int type)
+{
+    switch(type) {
+    case DBUS_TYPE_BYTE:
+    case DBUS_TYPE_BOOLEAN:
+    case DBUS_TYPE_INT16:
+    case DBUS_TYPE_UINT16:
+    case DBUS_TYPE_INT32:
+    case DBUS_TYPE_UINT32:
+    case DBUS_TYPE_INT64:
+    case DBUS_TYPE_UINT64:
+    case DBUS_TYPE_DOUBLE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool isStringType(int type)
+{
+    return type == DBUS_TYPE_STRING || type == DBUS_TYPE_OBJECT_PATH || type == DBUS_TYPE_SIGNATURE;
+}
+
+/* Skips one complete type of a signature */
+static const char *skipType(const char *sig)
+{
+    switch(*sig) {
+    case DBUS_TYPE_ARRAY:
+        return skipType(sig + 1);
+    case DBUS_STRUCT_BEGIN_CHAR:
+    case DBUS_DICT_ENTRY_BEGIN_CHAR:
+        ++sig;
+        while(*sig != DBUS_STRUCT_END_CHAR && *sig != DBUS_DICT_ENTRY_END_CHAR) {
+            sig = skipType(sig);
+        }
+        return sig + 1;
+    default:
+        return sig + 1;
+    }
+}
+
+/* Copies the value from points to at the end of to. File descriptors are refused */
+static dbus_bool_t copyValue(DBusMessageIter *from, DBusMessageIter *to)
+{
+    int type = dbus_message_iter_get_arg_type(from);
+    __BasicValue value;
+    if(types::__readBasic(from, &value) != DBUS_TYPE_INVALID) {
+        return dbus_message_iter_append_basic(to, type, &value);
+    }
+    if(!dbus_type_is_container(type)) {
+        return FALSE;
+    }
+
+    DBusMessageIter fromSub, toSub;
+    char *signature = NULL;
+    const char *contained = NULL;
+    dbus_message_iter_recurse(from, &fromSub);
+    if(type == DBUS_TYPE_ARRAY) {
+        signature = dbus_message_iter_get_signature(from);
+        contained = signature ? signature + 1 : NULL;
+    }
+    else if(type == DBUS_TYPE_VARIANT) {
+        signature = dbus_message_iter_get_signature(&fromSub);
+        contained = signature;
+    }
+    if(type != DBUS_TYPE_STRUCT && type != DBUS_TYPE_DICT_ENTRY && !contained) {
+        return FALSE;
+    }
+    if(!dbus_message_iter_open_container(to, type, contained, &toSub)) {
+        dbus_free(signature);
+        return FALSE;
+    }
+
+    dbus_bool_t ret = TRUE;
+    int elementType = type == DBUS_TYPE_ARRAY ? dbus_message_iter_get_element_type(from) : DBUS_TYPE_INVALID;
+    if(isFixedType(elementType)) {
+        const void *elements;
+        int n;
+        dbus_message_iter_get_fixed_array(&fromSub, &elements, &n);
+        ret = dbus_message_iter_append_fixed_array(&toSub, elementType, &elements, n);
+    }
+    else {
+        while(ret && dbus_message_iter_get_arg_type(&fromSub) != DBUS_TYPE_INVALID) {
+            ret = copyValue(&fromSub, &toSub);
+            dbus_message_iter_next(&fromSub);
+        }
+    }
+    dbus_free(signature);
+    return dbus_message_iter_close_container(to, &toSub) && ret;
+}
+
+/* Writes a fixed size or string basic value at pos. buf is NULL to compute the end only */
+static size_t wireWriteBasic(char *buf, size_t pos, int type, const __BasicValue& value,
+    const char *str, size_t len)
+{
+    if(type == DBUS_TYPE_SIGNATURE) {
+        if(buf) {
+            buf[pos] = len;
+            memcpy(buf + pos + 1, str, len + 1);
+        }
+        return pos + 1 + len + 1;
+    }
+    if(isStringType(type)) {
+        dbus_uint32_t l = len;
+        if(buf) {
+            pos = __wirePad(buf, pos, 4);
+            memcpy(buf + pos, &l, 4);
+            memcpy(buf + pos + 4, str, len + 1);
+        }
+        else {
+            pos = __wireAlign(pos, 4);
+        }
+        return pos + 4 + len + 1;
+    }
+    size_t size = fixedSize(type);
+    if(buf) {
+        pos = __wirePad(buf, pos, size);
+        memcpy(buf + pos, &value, size);
+    }
+    else {
+        pos = __wireAlign(pos, size);
+    }
+    return pos + size;
+}
+
+/* Writes the value from points to at pos, in wire format. buf is NULL to compute the end only */
+static size_t wireWriteValue(char *buf, size_t pos, DBusMessageIter *from)
+{
+    int type = dbus_message_iter_get_arg_type(from);
+#ifdef DBUS_TYPE_UNIX_FD
+    //Descriptors travel beside the body, which the wire format can't do: only their index
+    //into them is in the body, and its size can still be computed
+    if(type == DBUS_TYPE_UNIX_FD) {
+        if(buf) {
+            types::__wireRejected = true;
+        }
+        return __wireAlign(pos, 4) + 4;
+    }
+#endif
+    __BasicValue value;
+    if(types::__readBasic(from, &value) != DBUS_TYPE_INVALID) {
+        size_t len = isStringType(type) ? strlen(value.str) : 0;
+        return wireWriteBasic(buf, pos, type, value, value.str, len);
+    }
+
+    DBusMessageIter sub;
+    dbus_message_iter_recurse(from, &sub);
+    switch(type) {
+    case DBUS_TYPE_ARRAY: {
+        size_t lengthPos = buf ? __wirePad(buf, pos, 4) : __wireAlign(pos, 4);
+        int elementType = dbus_message_iter_get_element_type(from);
+        size_t elementAlignment = alignment(elementType);
+        pos = buf ? __wirePad(buf, lengthPos + 4, elementAlignment) : __wireAlign(lengthPos + 4, elementAlignment);
+        size_t start = pos;
+        if(isFixedType(elementType)) {
+            const void *elements;
+            int n;
+            dbus_message_iter_get_fixed_array(&sub, &elements, &n);
+            if(buf) {
+                memcpy(buf + pos, elements, n * fixedSize(elementType));
+            }
+            pos += n * fixedSize(elementType);
+        }
+        else {
+            while(dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_INVALID) {
+                pos = wireWriteValue(buf, pos, &sub);
+                dbus_message_iter_next(&sub);
+            }
+        }
+        if(buf) {
+            dbus_uint32_t l = pos - start;
+            memcpy(buf + lengthPos, &l, 4);
+        }
+        return pos;
+    }
+    case DBUS_TYPE_VARIANT: {
+        char *signature = dbus_message_iter_get_signature(&sub);
+        const char *sig = signature ? signature : "";
+        pos = wireWriteBasic(buf, pos, DBUS_TYPE_SIGNATURE, value, sig, strlen(sig));
+        dbus_free(signature);
+        return wireWriteValue(buf, pos, &sub);
+    }
+    default:
+        //Structs and dict entries
+        pos = buf ? __wirePad(buf, pos, 8) : __wireAlign(pos, 8);
+        while(dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_INVALID) {
+            pos = wireWriteValue(buf, pos, &sub);
+            dbus_message_iter_next(&sub);
+        }
+        return pos;
+    }
+}
+
+/* Reads the value of type *sig at pos, and appends it to to.
+ * Advances sig past the type, and returns the end of the value */
+static size_t wireReadValue(const char *buf, size_t pos, const char **sig, DBusMessageIter *to,
+    dbus_bool_t *ok)
+{
+    int type = **sig;
+    const char *end = skipType(*sig);
+    const char *contained = *sig + 1;
+    *sig = end;
+
+    if(type == DBUS_TYPE_SIGNATURE) {
+        const char *str = buf + pos + 1;
+        *ok = *ok && dbus_message_iter_append_basic(to, type, &str);
+        return pos + 1 + (unsigned char)buf[pos] + 1;
+    }
+    if(isStringType(type)) {
+        dbus_uint32_t len;
+        pos = __wireAlign(pos, 4);
+        memcpy(&len, buf + pos, 4);
+        const char *str = buf + pos + 4;
+        *ok = *ok && dbus_message_iter_append_basic(to, type, &str);
+        return pos + 4 + len + 1;
+    }
+    if(isFixedType(type)) {
+        __BasicValue value;
+        size_t size = fixedSize(type);
+        pos = __wireAlign(pos, size);
+        memcpy(&value, buf + pos, size);
+        *ok = *ok && dbus_message_iter_append_basic(to, type, &value);
+        return pos + size;
+    }
+
+    DBusMessageIter sub;
+    switch(type) {
+    case DBUS_TYPE_ARRAY: {
+        //D-Bus signatures are at most 255 bytes long
+        char elementSignature[DBUS_MAXIMUM_SIGNATURE_LENGTH + 1];
+        memcpy(elementSignature, contained, end - contained);
+        elementSignature[end - contained] = 0;
+        dbus_uint32_t len;
+        pos = __wireAlign(pos, 4);
+        memcpy(&len, buf + pos, 4);
+        int elementType = *contained;
+        pos = __wireAlign(pos + 4, alignment(elementType));
+        size_t arrayEnd = pos + len;
+        *ok = *ok && dbus_message_iter_open_container(to, type, elementSignature, &sub);
+        if(!*ok) {
+            return arrayEnd;
+        }
+        if(isFixedType(elementType)) {
+            const char *elements = buf + pos;
+            *ok = dbus_message_iter_append_fixed_array(&sub, elementType, &elements, len / fixedSize(elementType));
+        }
+        else {
+            while(pos < arrayEnd) {
+                const char *elementSig = contained;
+                pos = wireReadValue(buf, pos, &elementSig, &sub, ok);
+            }
+        }
+        *ok = dbus_message_iter_close_container(to, &sub) && *ok;
+        return arrayEnd;
+    }
+    case DBUS_TYPE_VARIANT: {
+        const char *valueSig = buf + pos + 1;
+        pos += 1 + (unsigned char)buf[pos] + 1;
+        *ok = *ok && dbus_message_iter_open_container(to, type, valueSig, &sub);
+        if(!*ok) {
+            return pos;
+        }
+        pos = wireReadValue(buf, pos, &valueSig, &sub, ok);
+        *ok = dbus_message_iter_close_container(to, &sub) && *ok;
+        return pos;
+    }
+    case DBUS_STRUCT_BEGIN_CHAR:
+    case DBUS_DICT_ENTRY_BEGIN_CHAR: {
+        int containerType = type == DBUS_STRUCT_BEGIN_CHAR ? DBUS_TYPE_STRUCT : DBUS_TYPE_DICT_ENTRY;
+        pos = __wireAlign(pos, 8);
+        *ok = *ok && dbus_message_iter_open_container(to, containerType, NULL, &sub);
+        if(!*ok) {
+            return pos;
+        }
+        const char *fieldSig = contained;
+        while(fieldSig < end - 1) {
+            pos = wireReadValue(buf, pos, &fieldSig, &sub, ok);
+        }
+        *ok = dbus_message_iter_close_container(to, &sub) && *ok;
+        return pos;
+    }
+    default:
+        //File descriptors
+        *ok = FALSE;
+        return __wireAlign(pos, 4) + 4;
+    }
+}
+
+Variant::Variant(const Variant& other) : _type(DBUS_TYPE_INVALID), _length(0)
+{
+    *this = other;
+}
+
+#ifdef DBUSTL_CXX0X
+Variant::Variant(Variant&& other) : _type(DBUS_TYPE_INVALID), _length(0)
+{
+    swap(other);
+}
+
+Variant& Variant::operator=(Variant&& other)
+{
+    swap(other);
+    other.clear();
+    return *this;
+}
+#endif
+
+Variant::~Variant()
+{
+    clear();
+}
+
+Variant& Variant::operator=(const Variant& other)
+{
+    if(this == &other) {
+        return *this;
+    }
+    if(other.isString()) {
+        setString(other._type, other.chars(), other._length);
+    }
+    else if(other.inMessage()) {
+        adoptMessage(dbus_message_ref(other._message));
+    }
+    else {
+        setBasic(other._type, other._basic);
+    }
+    return *this;
+}
+
+void Variant::swap(Variant& other)
+{
+    //Nothing points inside a Variant: the union is swapped as raw bytes
+    char tmp[InlineSize];
+    memcpy(tmp, _chars, InlineSize);
+    memcpy(_chars, other._chars, InlineSize);
+    memcpy(other._chars, tmp, InlineSize);
+    std::swap(_type, other._type);
+    std::swap(_length, other._length);
+}
+
+void Variant::clear()
+{
+    if(isString() && _length >= InlineSize) {
+        delete[] _heapChars;
+    }
+    else if(inMessage()) {
+        dbus_message_unref(_message);
+    }
+    _type = DBUS_TYPE_INVALID;
+    _length = 0;
+}
+
+bool Variant::inMessage() const
+{
+    return _type != DBUS_TYPE_INVALID && !dbus_type_is_basic(_type);
+}
+
+bool Variant::isString() const
+{
+    return isStringType(_type);
+}
+
+const char *Variant::chars() const
+{
+    return _length < InlineSize ? _chars : _heapChars;
+}
+
+const char *Variant::signature() const
+{
+    switch(_type) {
+    case DBUS_TYPE_INVALID:
+        return "";
+    case DBUS_TYPE_BYTE:
+        return DBUS_TYPE_BYTE_AS_STRING;
+    case DBUS_TYPE_BOOLEAN:
+        return DBUS_TYPE_BOOLEAN_AS_STRING;
+    case DBUS_TYPE_INT16:
+        return DBUS_TYPE_INT16_AS_STRING;
+    case DBUS_TYPE_UINT16:
+        return DBUS_TYPE_UINT16_AS_STRING;
+    case DBUS_TYPE_INT32:
+        return DBUS_TYPE_INT32_AS_STRING;
+    case DBUS_TYPE_UINT32:
+        return DBUS_TYPE_UINT32_AS_STRING;
+    case DBUS_TYPE_INT64:
+        return DBUS_TYPE_INT64_AS_STRING;
+    case DBUS_TYPE_UINT64:
+        return DBUS_TYPE_UINT64_AS_STRING;
+    case DBUS_TYPE_DOUBLE:
+        return DBUS_TYPE_DOUBLE_AS_STRING;
+    case DBUS_TYPE_STRING:
+        return DBUS_TYPE_STRING_AS_STRING;
+    case DBUS_TYPE_OBJECT_PATH:
+        return DBUS_TYPE_OBJECT_PATH_AS_STRING;
+    case DBUS_TYPE_SIGNATURE:
+        return DBUS_TYPE_SIGNATURE_AS_STRING;
+    default:
+        //The message holds nothing but the value
+        return dbus_message_get_signature(_message);
+    }
+}
+
+void Variant::setBasic(int type, const __BasicValue& value)
+{
+    clear();
+    _type = type;
+    _basic = value;
+}
+
+void Variant::setString(int type, const char *str, size_t len)
+{
+    clear();
+    char *dest = _chars;
+    if(len >= InlineSize) {
+        dest = new char[len + 1];
+        _heapChars = dest;
+    }
+    memcpy(dest, str, len);
+    dest[len] = 0;
+    _type = type;
+    _length = len;
+}
+
+void Variant::adoptMessage(DBusMessage *msg)
+{
+    clear();
+    if(!msg) {
+        return;
+    }
+    DBusMessageIter it;
+    dbus_message_iter_init(msg, &it);
+    _type = dbus_message_iter_get_arg_type(&it);
+    _message = msg;
+}
+
+dbus_bool_t Variant::serialize(DBusMessageIter* it) const
+{
+    if(_type == DBUS_TYPE_INVALID) {
+        return FALSE;
+    }
+    DBusMessageIter sub;
+    if(!dbus_message_iter_open_container(it, DBUS_TYPE_VARIANT, signature(), &sub)) {
+        return FALSE;
+    }
+    dbus_bool_t ret;
+    if(inMessage()) {
+        DBusMessageIter from;
+        dbus_message_iter_init(_message, &from);
+        ret = copyValue(&from, &sub);
+    }
+    else if(isString()) {
+        const char *str = chars();
+        ret = dbus_message_iter_append_basic(&sub, _type, &str);
+    }
+    else {
+        ret = dbus_message_iter_append_basic(&sub, _type, &_basic);
+    }
+    return dbus_message_iter_close_container(it, &sub) && ret;
+}
+
+dbus_bool_t Variant::deserialize(DBusMessageIter* it)
+{
+    if(dbus_message_iter_get_arg_type(it) != DBUS_TYPE_VARIANT) {
+        return FALSE;
+    }
+    DBusMessageIter sub;
+    dbus_message_iter_recurse(it, &sub);
+    __BasicValue value;
+    int type = types::__readBasic(&sub, &value);
+    if(isStringType(type)) {
+        setString(type, value.str, strlen(value.str));
+        return TRUE;
+    }
+    if(type != DBUS_TYPE_INVALID) {
+        setBasic(type, value);
+        return TRUE;
+    }
+
+    DBusMessage *msg = dbus_message_new(DBUS_MESSAGE_TYPE_METHOD_CALL);
+    if(!msg) {
+        return FALSE;
+    }
+    DBusMessageIter to;
+    dbus_message_iter_init_append(msg, &to);
+    if(!copyValue(&sub, &to)) {
+        dbus_message_unref(msg);
+        return FALSE;
+    }
+    adoptMessage(msg);
+    return TRUE;
+}
+
+namespace types {
+
+size_t __wireBodySize(DBusMessage *msg)
+{
+    DBusMessageIter it;
+    size_t pos = 0;
+    if(dbus_message_iter_init(msg, &it)) {
+        do {
+            pos = wireWriteValue(NULL, pos, &it);
+        } while(dbus_message_iter_next(&it));
+    }
+    return pos;
+}
+
+}
+
+size_t Variant::wireWrite(char *buf, size_t pos) const
+{
+    const char *sig = signature();
+    pos = wireWriteBasic(buf, pos, DBUS_TYPE_SIGNATURE, _basic, sig, strlen(sig));
+    if(inMessage()) {
+        DBusMessageIter from;
+        dbus_message_iter_init(_message, &from);
+        return wireWriteValue(buf, pos, &from);
+    }
+    if(isString()) {
+        return wireWriteBasic(buf, pos, _type, _basic, chars(), strlen(chars()));
+    }
+    if(_type == DBUS_TYPE_INVALID) {
+        return pos;
+    }
+    return wireWriteBasic(buf, pos, _type, _basic, NULL, 0);
+}
+
+size_t Variant::wireRead(const char *buf, size_t pos)
+{
+    const char *sig = buf + pos + 1;
+    pos += 1 + (unsigned char)buf[pos] + 1;
+    int type = *sig;
+    if(isStringType(type)) {
+        size_t len;
+        if(type == DBUS_TYPE_SIGNATURE) {
+            len = (unsigned char)buf[pos];
+            setString(type, buf + pos + 1, len);
+            return pos + 1 + len + 1;
+        }
+        dbus_uint32_t l;
+        pos = __wireAlign(pos, 4);
+        memcpy(&l, buf + pos, 4);
+        setString(type, buf + pos + 4, l);
+        return pos + 4 + l + 1;
+    }
+    if(isFixedType(type)) {
+        __BasicValue value;
+        size_t size = fixedSize(type);
+        pos = __wireAlign(pos, size);
+        memcpy(&value, buf + pos, size);
+        setBasic(type, value);
+        return pos + size;
+    }
+
+    clear();
+    DBusMessage *msg = dbus_message_new(DBUS_MESSAGE_TYPE_METHOD_CALL);
+    if(!msg) {
+        return pos;
+    }
+    DBusMessageIter to;
+    dbus_bool_t ok = TRUE;
+    dbus_message_iter_init_append(msg, &to);
+    pos = wireReadValue(buf, pos, &sig, &to, &ok);
+    if(!ok) {
+        dbus_message_unref(msg);
+        return pos;
+    }
+    adoptMessage(msg);
+    return pos;
+}
+
+}
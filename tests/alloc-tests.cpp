@@ -0,0 +1,547 @@
+/*
+ *  DBusTL - D-Bus Template Library
+ *
+ *  Copyright (C) 2008, 2009  Fabien Chevalier <chefabien@gmail.com>
+ *
+ *
+ *  This file is part of the D-Bus Template Library.
+ *
+ *  The D-Bus Template Library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  D-Bus Template Library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with D-Bus Template Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Heap allocation budgets for the hot paths.
+ * 
+ * Global operator new is interposed to count C++ allocations (libdbus' own 
+ * malloc() calls are not counted: we can't do anything about them). 
+ * Each test checks that a hot path does not allocate more than it does today: 
+ * if a change makes one of them fail, either avoid the new allocation, or bump the 
+ * budget if it is really needed.
+ * 
+ * Requires a session bus: exits with 77 (skipped) if there is none.
+ */
+
+#include <dbustl-1/dbustl>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#ifdef DBUSTL_CXX0X
+#include <unordered_map>
+#endif
+#include <vector>
+#include <new>
+
+#include <cstdlib>
+
+//Dynamic exception specifications are gone in C++17
+#if __cplusplus >= 201103L
+    #define NEW_THROW
+    #define DELETE_THROW noexcept
+#else
+    #define NEW_THROW throw(std::bad_alloc)
+    #define DELETE_THROW throw()
+#endif
+
+static bool counting = false;
+static unsigned long allocations = 0;
+
+void* operator new(std::size_t size) NEW_THROW
+{
+    if(counting) {
+        ++allocations;
+    }
+    void *p = malloc(size ? size : 1);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](std::size_t size) NEW_THROW
+{
+    return operator new(size);
+}
+
+//Every operator new above gets its memory from malloc() or posix_memalign(), so free() is
+//the right deallocation function, but GCC can't tell once the sized versions are inlined
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void *p) DELETE_THROW
+{
+    free(p);
+}
+
+void operator delete[](void *p) DELETE_THROW
+{
+    free(p);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void *p, std::size_t) DELETE_THROW
+{
+    free(p);
+}
+
+void operator delete[](void *p, std::size_t) DELETE_THROW
+{
+    free(p);
+}
+#endif
+
+//std::pmr::monotonic_buffer_resource, among others, allocates with an alignment
+#ifdef __cpp_aligned_new
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    if(counting) {
+        ++allocations;
+    }
+    void *p = NULL;
+    if(posix_memalign(&p, std::max(sizeof(void *), static_cast<std::size_t>(alignment)), size ? size : 1)) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept
+{
+    free(p);
+}
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+static void startCounting()
+{
+    allocations = 0;
+    counting = true;
+}
+
+static unsigned long stopCounting()
+{
+    counting = false;
+    return allocations;
+}
+
+static int failures = 0;
+
+static void checkBudget(const char *what, unsigned long count, unsigned long budget)
+{
+    std::cout << ">" << what << ": " << count << " allocation(s), budget " << budget << std::endl;
+    if(count > budget) {
+        std::cerr << "Allocation budget exceeded for " << what << std::endl;
+        failures++;
+    }
+}
+
+/* Dispatches incoming messages until the one for member is at the head of the queue,
+ * then dispatches that one while counting allocations */
+static unsigned long dispatchCounted(DBusConnection *conn, const char *member)
+{
+    for(;;) {
+        while(dbus_connection_get_dispatch_status(conn) != DBUS_DISPATCH_DATA_REMAINS) {
+            dbus_connection_read_write(conn, 100);
+        }
+        DBusMessage *msg = dbus_connection_borrow_message(conn);
+        bool found = msg && dbus_message_has_member(msg, member);
+        dbus_connection_return_message(conn, msg);
+        if(found) {
+            startCounting();
+            dbus_connection_dispatch(conn);
+            return stopCounting();
+        }
+        dbus_connection_dispatch(conn);
+    }
+}
+
+struct Sample {
+    uint64_t timestamp;
+    int32_t channel;
+    double value;
+};
+bool operator==(const Sample& s1, const Sample& s2)
+{
+    return s1.timestamp == s2.timestamp && s1.channel == s2.channel && s1.value == s2.value;
+}
+DBUSTL_REGISTER_STRUCT_3(Sample, timestamp, channel, value);
+
+class AllocService : public dbustl::DBusObject {
+public:
+    AllocService(dbustl::Connection *conn) : DBusObject("/AllocService", "org.dbustl.AllocTest", conn), pings(0) 
+    {
+        exportMethod("Ping", this, &AllocService::ping);
+        exportSignal("Tick", dbustl::SignatureBuilder());
+    }
+
+    void ping() { pings++; }
+
+    int pings;
+};
+
+struct TickHandler {
+    TickHandler(int *ticks) : _ticks(ticks) {}
+    void operator()(dbustl::Message&) const { (*_ticks)++; }
+    int *_ticks;
+};
+
+int main()
+{
+    dbustl::Connection *server;
+    dbustl::Connection *client;
+
+    try {
+        server = new dbustl::Connection(DBUS_BUS_SESSION);
+        client = new dbustl::Connection(DBUS_BUS_SESSION);
+    }
+    catch(const std::exception& e) {
+        std::cerr << "No session bus, skipping: " << e.what() << std::endl;
+        return 77;
+    }
+    const char *serverName = dbus_bus_get_unique_name(server->dbus());
+
+    {
+        std::vector<int> values(1000, 42);
+        //Once to warm up, once for real
+        for(int i = 0; i < 2; ++i) {
+            dbustl::Message msg(dbus_message_new_signal("/AllocService", "org.dbustl.AllocTest", "Values"));
+            startCounting();
+            msg << values;
+            unsigned long count = stopCounting();
+            if(i == 1) {
+                checkBudget("serialize std::vector<int>", count, 0);
+            }
+
+            dbustl::Message received(dbus_message_copy(msg.dbus()));
+            std::vector<int> out;
+            startCounting();
+            received >> out;
+            count = stopCounting();
+            if(i == 1) {
+                checkBudget("deserialize std::vector<int>", count, 1);
+            }
+            if(out != values) {
+                std::cerr << "Deserialized vector differs" << std::endl;
+                failures++;
+            }
+        }
+    }
+
+    {
+        std::vector<std::string> names(100, "a name too long to be stored inline by std::string");
+        std::vector<std::string> out;
+        for(int i = 0; i < 2; ++i) {
+            dbustl::Message msg(dbus_message_new_signal("/AllocService", "org.dbustl.AllocTest", "Names"));
+            msg << names;
+
+            dbustl::Message received(dbus_message_copy(msg.dbus()));
+            startCounting();
+            received >> dbustl::reuse(out);
+            unsigned long count = stopCounting();
+            //out already has room for everything the second time
+            if(i == 1) {
+                checkBudget("deserialize reused std::vector<std::string>", count, 0);
+            }
+            if(received.error() || out != names) {
+                std::cerr << "Reused vector differs" << std::endl;
+                failures++;
+            }
+        }
+    }
+
+    {
+        //Keys and values short enough to be stored inline
+        std::map<std::string, dbustl::Variant> properties;
+        for(int j = 0; j < 25; ++j) {
+            std::ostringstream key;
+            key << "Property" << j;
+            switch(j % 5) {
+            case 0: properties[key.str()] = j; break;
+            case 1: properties[key.str()] = (j % 2) == 0; break;
+            case 2: properties[key.str()] = j / 2.0; break;
+            case 3: properties[key.str()] = (uint64_t)j << 40; break;
+            default: properties[key.str()] = key.str(); break;
+            }
+        }
+        for(int i = 0; i < 2; ++i) {
+            dbustl::Message msg(dbus_message_new_signal("/AllocService", "org.dbustl.AllocTest", "Properties"));
+            msg << properties;
+
+            dbustl::Message received(dbus_message_copy(msg.dbus()));
+            std::map<std::string, dbustl::Variant> out;
+            startCounting();
+            received >> out;
+            unsigned long count = stopCounting();
+            //The tree nodes only
+            if(i == 1) {
+                checkBudget("deserialize std::map<std::string, dbustl::Variant>", count, properties.size());
+            }
+            if(received.error() || out.size() != properties.size()
+                || out["Property5"].get<int>() != 5 || out["Property9"].get<std::string>() != "Property9") {
+                std::cerr << "Deserialized properties differ" << std::endl;
+                failures++;
+            }
+        }
+    }
+
+    {
+        std::map<std::string, dbustl::Variant> properties;
+        for(int j = 0; j < 100; ++j) {
+            std::ostringstream key;
+            key << "a property name too long to be stored inline " << j;
+            if(j % 2) {
+                properties[key.str()] = std::vector<std::string>(1, key.str());
+            }
+            else {
+                properties[key.str()] = int32_t(j);
+            }
+        }
+        for(int i = 0; i < 2; ++i) {
+            dbustl::Message msg(dbus_message_new_signal("/AllocService", "org.dbustl.AllocTest", "Properties"));
+            msg << properties;
+
+            dbustl::Message received(dbus_message_copy(msg.dbus()));
+            dbustl::DictView<std::string> view;
+            startCounting();
+            received >> view;
+            int32_t value = view.get<int32_t>("a property name too long to be stored inline 8");
+            unsigned long count = stopCounting();
+            //The index, whose vector grows geometrically, and the std::string built for the key
+            if(i == 1) {
+                checkBudget("lookup in a dbustl::DictView of 100 entries", count, 9);
+            }
+            if(received.error() || view.size() != properties.size() || value != 8
+                || view.get<std::vector<std::string> >("a property name too long to be stored inline 7").size() != 1) {
+                std::cerr << "Dictionary view differs" << std::endl;
+                failures++;
+            }
+        }
+    }
+
+#ifdef DBUSTL_CXX0X
+    {
+        std::vector<int> values(1000, 42);
+        for(int i = 0; i < 2; ++i) {
+            dbustl::Message msg(dbus_message_new_signal("/AllocService", "org.dbustl.AllocTest", "Values"));
+            startCounting();
+            msg.marshal(values, std::string("values"));
+            unsigned long count = stopCounting();
+            if(i == 1) {
+                checkBudget("marshal std::vector<int>", count, 0);
+            }
+
+            std::vector<int> out;
+            std::string name;
+            msg >> out >> name;
+            if(msg.error() || out != values || name != "values") {
+                std::cerr << "Marshalled message differs" << std::endl;
+                failures++;
+            }
+
+            dbustl::Message received(dbus_message_copy(msg.dbus()));
+            std::vector<int> unmarshalled;
+            std::string unmarshalledName;
+            startCounting();
+            received.unmarshal(unmarshalled, unmarshalledName);
+            count = stopCounting();
+            if(i == 1) {
+                checkBudget("unmarshal std::vector<int>", count, 1);
+            }
+            if(received.error() || unmarshalled != values || unmarshalledName != "values") {
+                std::cerr << "Unmarshalled values differ" << std::endl;
+                failures++;
+            }
+        }
+    }
+
+    {
+        std::vector<Sample> samples(1000);
+        for(size_t j = 0; j < samples.size(); ++j) {
+            samples[j].timestamp = j;
+            samples[j].channel = j % 4;
+            samples[j].value = j / 4.0;
+        }
+        for(int i = 0; i < 2; ++i) {
+            dbustl::Message msg(dbus_message_new_signal("/AllocService", "org.dbustl.AllocTest", "Samples"));
+            msg.marshal(samples);
+
+            dbustl::Message received(dbus_message_copy(msg.dbus()));
+            std::vector<Sample> out;
+            startCounting();
+            received.unmarshal(out);
+            unsigned long count = stopCounting();
+            if(i == 1) {
+                checkBudget("unmarshal std::vector<struct>", count, 1);
+            }
+            if(received.error() || out != samples) {
+                std::cerr << "Unmarshalled structs differ" << std::endl;
+                failures++;
+            }
+        }
+    }
+
+    {
+        //Keys too long for the small string optimization
+        std::map<std::string, std::vector<int> > index;
+        for(int j = 0; j < 100; ++j) {
+            std::ostringstream key;
+            key << "a key too long to be stored inline by std::string " << j;
+            index[key.str()] = std::vector<int>(4, j);
+        }
+        for(int i = 0; i < 2; ++i) {
+            dbustl::Message msg(dbus_message_new_signal("/AllocService", "org.dbustl.AllocTest", "Index"));
+            msg << index;
+
+            dbustl::Message received(dbus_message_copy(msg.dbus()));
+            std::map<std::string, std::vector<int> > out;
+            startCounting();
+            received >> out;
+            unsigned long count = stopCounting();
+            //Per entry: the key, the tree node and the vector buffer
+            if(i == 1) {
+                checkBudget("deserialize std::map<std::string, std::vector<int> >", count, 3 * index.size());
+            }
+            if(received.error() || out != index) {
+                std::cerr << "Deserialized map differs" << std::endl;
+                failures++;
+            }
+        }
+    }
+
+    {
+        std::unordered_map<int32_t, int32_t> table;
+        for(int32_t j = 0; j < 1000; ++j) {
+            table[j * 7] = j;
+        }
+        for(int i = 0; i < 2; ++i) {
+            dbustl::Message msg(dbus_message_new_signal("/AllocService", "org.dbustl.AllocTest", "Table"));
+            msg << table;
+
+            dbustl::Message received(dbus_message_copy(msg.dbus()));
+            std::unordered_map<int32_t, int32_t> out;
+            startCounting();
+            received >> out;
+            unsigned long count = stopCounting();
+            //The nodes and a single bucket array: the table is reserved before the first insertion
+            if(i == 1) {
+                checkBudget("deserialize std::unordered_map<int32_t, int32_t>", count, table.size() + 1);
+            }
+            if(received.error() || out != table) {
+                std::cerr << "Deserialized unordered map differs" << std::endl;
+                failures++;
+            }
+        }
+    }
+
+#ifdef DBUSTL_PMR
+    {
+        std::vector<std::string> names(100, "a name too long to be stored inline by std::string");
+        for(int i = 0; i < 2; ++i) {
+            dbustl::Message msg(dbus_message_new_signal("/AllocService", "org.dbustl.AllocTest", "Names"));
+            msg << names;
+
+            dbustl::Message received(dbus_message_copy(msg.dbus()));
+            //The values don't fit in the buffer of the arena: it gets more memory out of 
+            //a buffer of ours, and can't fall back on operator new
+            static char upstreamBuffer[64 * 1024];
+            std::pmr::monotonic_buffer_resource upstream(upstreamBuffer, sizeof(upstreamBuffer), 
+                std::pmr::null_memory_resource());
+            dbustl::DeserializationArena arena(&upstream);
+            startCounting();
+            std::pmr::vector<std::pmr::string> out = std::get<0>(received.read<std::pmr::vector<std::pmr::string> >(&arena));
+            unsigned long count = stopCounting();
+            //Everything comes from the arena, so nothing from operator new
+            if(i == 1) {
+                checkBudget("deserialize std::pmr::vector<std::pmr::string> in an arena", count, 0);
+            }
+            if(received.error() || out.size() != names.size() || out[0] != names[0].c_str()) {
+                std::cerr << "Arena deserialized vector differs" << std::endl;
+                failures++;
+            }
+        }
+    }
+#endif
+#endif
+
+    {
+        AllocService service(server);
+        for(int i = 0; i < 2; ++i) {
+            DBusMessage *call = dbus_message_new_method_call(serverName, "/AllocService", 
+                "org.dbustl.AllocTest", "Ping");
+            dbus_message_set_no_reply(call, TRUE);
+            dbus_connection_send(client->dbus(), call, NULL);
+            dbus_message_unref(call);
+            dbus_connection_flush(client->dbus());
+
+            unsigned long count = dispatchCounted(server->dbus(), "Ping");
+            if(i == 1) {
+                checkBudget("DBusObject no-arg method dispatch", count, 1);
+            }
+        }
+        if(service.pings != 2) {
+            std::cerr << "Ping not dispatched" << std::endl;
+            failures++;
+        }
+
+        int ticks = 0;
+        dbustl::ObjectProxy proxy(client, "/AllocService", serverName);
+        proxy.setSignalHandler("Tick", TickHandler(&ticks));
+        for(int i = 0; i < 2; ++i) {
+            dbustl::Message tick = service.createSignal("Tick");
+            service.emitSignal(tick);
+            server->flush();
+
+            unsigned long count = dispatchCounted(client->dbus(), "Tick");
+            if(i == 1) {
+                checkBudget("ObjectProxy signal delivery", count, 0);
+            }
+        }
+        if(ticks != 2) {
+            std::cerr << "Tick not delivered" << std::endl;
+            failures++;
+        }
+    }
+
+    delete client;
+    delete server;
+    return failures ? 1 : 0;
+}
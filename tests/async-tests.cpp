@@ -286,10 +286,18 @@ int main()
         pythonObjectProxy.setSignalHandler("exampleSignal2", &ExampleSignal2MethodCallback::method, &object2); 
         pythonObjectProxy.setSignalHandler("exampleSignal3", ExampleSignal3FunctorCallback()); 
         pythonObjectProxy.setSignalHandler("", ExampleSignalXFunctorCallback()); 
+#ifdef DBUSTL_CXX0X
+        pythonObjectProxy.setSignalHandler<uint32_t, std::string>("exampleSignal5", 
+            [](const uint32_t& code, const std::string& text) {
+                assert(code == 5);
+                assert(text == "Signal 5 value");
+                n_cbs++;
+            });
+#endif
         dbustl::Message callMsg = pythonObjectProxy.createMethodCall("SendSignals");
         pythonObjectProxy.asyncCall(callMsg, &voidMethodCallback);
-        //We expect 4 signals to be received
-        expected_cbs += 4; 
+        //We expect 5 signals to be received
+        expected_cbs += 5; 
     }
     CATCH(const std::exception& e,
         std::cerr << e.what() << std::endl;
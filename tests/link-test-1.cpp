@@ -62,7 +62,8 @@ public:
 void testMessage1(dbustl::Message& m)
 {	
 	{
-		bool t;
+		//Initialized, as m >> t leaves it alone if it fails
+		bool t = false;
 		m >> t;
 		m << t;
 	}
@@ -81,9 +82,9 @@ void testMessage1(dbustl::Message& m)
 	}
 	
 	{
-		signed char t;
-		//Note : deserialization does not exist for signed char due to lack of 
-		//adequate DBUS representation
+		//Widened to INT16 on the wire
+		signed char t = 0;
+		m >> t;
 		m << t;
 	}
 	
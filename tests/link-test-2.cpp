@@ -72,7 +72,8 @@ public:
 void testMessage2(dbustl::Message& m)
 {
 	{
-		bool t;
+		//Initialized, as m >> t leaves it alone if it fails
+		bool t = false;
 		m >> t;
 		m << t;
 	}
@@ -91,9 +92,9 @@ void testMessage2(dbustl::Message& m)
 	}
 	
 	{
-		signed char t;
-		//Note : deserialization does not exist for signed char due to lack of 
-		//adequate DBUS representation
+		//Widened to INT16 on the wire
+		signed char t = 0;
+		m >> t;
 		m << t;
 	}
 	
@@ -0,0 +1,916 @@
+/*
+ *  DBusTL - D-Bus Template Library
+ *
+ *  Copyright (C) 2008, 2009  Fabien Chevalier <chefabien@gmail.com>
+ *
+ *
+ *  This file is part of the D-Bus Template Library.
+ *
+ *  The D-Bus Template Library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  D-Bus Template Library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with D-Bus Template Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Tests that need nothing but a session bus: services are exported by this 
+ * process, on a connection of its own.
+ * 
+ * Requires a session bus: exits with 77 (skipped) if there is none.
+ */
+
+#include <dbustl-1/dbustl>
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <cstring>
+#include <ctime>
+#include <tuple>
+#include <vector>
+
+/* A signal with string arguments, for SignalFilter::matches() */
+static DBusMessage *stringSignal(const char *path, const char *arg0, const char *arg1 = NULL, 
+    const char *arg2 = NULL, const char *arg3 = NULL)
+{
+    DBusMessage *signal = dbus_message_new_signal(path, "org.dbustl.LoopbackTest", "Changed");
+    const char *args[] = {arg0, arg1, arg2, arg3};
+    for(int i = 0; i < 4 && args[i]; ++i) {
+        dbus_message_append_args(signal, DBUS_TYPE_STRING, &args[i], DBUS_TYPE_INVALID);
+    }
+    return signal;
+}
+
+struct ChangedHandler {
+    ChangedHandler(std::vector<std::string> *values) : _values(values) {}
+    void operator()(dbustl::Message& signal) const
+    {
+        std::string value;
+        signal >> value;
+        _values->push_back(value);
+    }
+    std::vector<std::string> *_values;
+};
+
+#if defined(DBUSTL_UNIX_FD) && defined(__linux__)
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <pthread.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+    #if defined(MFD_ALLOW_SEALING) && defined(F_ADD_SEALS)
+        #define HAVE_SEALED_FILES
+    #endif
+#endif
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if(!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl; \
+            failures++; \
+        } \
+    } while(0)
+
+/* Keeps the members of the messages whose handler stalled */
+class RecordingWatchdog : public dbustl::DispatchWatchdog {
+    public:
+        explicit RecordingWatchdog(unsigned long thresholdUs) : dbustl::DispatchWatchdog(thresholdUs) {}
+        virtual void stalled(const char *, const char *, const char *member, unsigned long)
+        {
+            stalls.push_back(member);
+        }
+        std::vector<std::string> stalls;
+};
+
+/* Dispatches incoming messages until the one for member has been dispatched: returns 
+ * false if it did not come within a few seconds */
+static bool dispatchUntil(DBusConnection *conn, const char *member)
+{
+    time_t deadline = time(NULL) + 5;
+    while(time(NULL) <= deadline) {
+        if(dbus_connection_get_dispatch_status(conn) != DBUS_DISPATCH_DATA_REMAINS) {
+            dbus_connection_read_write(conn, 100);
+            continue;
+        }
+        DBusMessage *msg = dbus_connection_borrow_message(conn);
+        bool found = msg && dbus_message_has_member(msg, member);
+        dbus_connection_return_message(conn, msg);
+        dbus_connection_dispatch(conn);
+        if(found) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifdef HAVE_SEALED_FILES
+//A memory file of size bytes, with seals
+static int sealedFile(size_t size, int seals)
+{
+    int fd = memfd_create("loopback-tests", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(fd >= 0 && (ftruncate(fd, size) < 0 || (seals && fcntl(fd, F_ADD_SEALS, seals) < 0))) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+class UploadService : public dbustl::DBusObject {
+public:
+    UploadService(dbustl::Connection *conn) : DBusObject("/UploadService", "org.dbustl.LoopbackTest", conn), received(0)
+    {
+        exportMethod("Upload", this, &UploadService::upload);
+        exportMethod("InlineUpload", this, &UploadService::upload);
+    }
+
+    void upload(const std::vector<uint8_t>& data) { received += data.size(); }
+
+    size_t received;
+};
+
+struct Dispatch {
+    DBusConnection *conn;
+    const char *member;
+};
+
+/* Runs dispatchUntil() in a thread of its own, while the main thread blocks on a call */
+static void *dispatchThread(void *arg)
+{
+    Dispatch *dispatch = static_cast<Dispatch *>(arg);
+    dispatchUntil(dispatch->conn, dispatch->member);
+    return 0;
+}
+
+/* Opens a channel for signal by hand, passing hangup: returns false if it is refused */
+static bool openChannel(DBusConnection *client, DBusConnection *server, const char *signal, int hangup)
+{
+    DBusMessage *call = dbus_message_new_method_call(dbus_bus_get_unique_name(server), "/ChannelService",
+        "org.dbustl.SignalChannel", signal);
+    const char *signature = "td";
+    dbus_message_append_args(call, DBUS_TYPE_STRING, &signature, DBUS_TYPE_UNIX_FD, &hangup, DBUS_TYPE_INVALID);
+    DBusPendingCall *pending = NULL;
+    dbus_connection_send_with_reply(client, call, &pending, -1);
+    dbus_message_unref(call);
+    dbus_connection_flush(client);
+    dispatchUntil(server, signal);
+    dbus_pending_call_block(pending);
+    DBusMessage *reply = dbus_pending_call_steal_reply(pending);
+    dbus_pending_call_unref(pending);
+    bool opened = dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_METHOD_RETURN;
+    dbus_message_unref(reply);
+    return opened;
+}
+
+static bool isReadable(int fd)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) == 1;
+}
+#endif
+
+int main()
+{
+    dbustl::Connection *server;
+    dbustl::Connection *client;
+
+    try {
+        server = new dbustl::Connection(DBUS_BUS_SESSION);
+        client = new dbustl::Connection(DBUS_BUS_SESSION);
+    }
+    catch(const std::exception& e) {
+        std::cerr << "No session bus, skipping: " << e.what() << std::endl;
+        return 77;
+    }
+
+#ifdef DBUSTL_CXX0X
+    {
+        std::cout << ">operator>> after unmarshal()" << std::endl;
+        dbustl::Message msg(dbus_message_new_signal("/LoopbackService", "org.dbustl.LoopbackTest", "Wire"));
+        msg << int32_t(1) << std::string("two");
+        dbustl::Message received(dbus_message_copy(msg.dbus()));
+        int32_t one = 0;
+        std::string two;
+        received.unmarshal(one, two);
+        CHECK(!received.error() && one == 1 && two == "two");
+        //All arguments were read: reading on must not start over
+        int32_t again = 0;
+        received >> again;
+        CHECK(received.error() && again == 0);
+    }
+
+    {
+        std::cout << ">Columns of odd length" << std::endl;
+        for(size_t n = 1; n < 8; n += 2) {
+            std::vector<uint64_t> timestamps;
+            std::vector<double> values;
+            for(size_t i = 0; i < n; ++i) {
+                timestamps.push_back(i);
+                values.push_back(i * 0.5);
+            }
+            dbustl::Message msg(dbus_message_new_signal("/LoopbackService", "org.dbustl.LoopbackTest", "Columns"));
+            msg << dbustl::columns(timestamps, values);
+            dbustl::Message copy1(dbus_message_copy(msg.dbus())), copy2(dbus_message_copy(msg.dbus()));
+            std::vector<uint64_t> t1, t2;
+            std::vector<double> v1, v2;
+            dbustl::Columns<std::vector<uint64_t>, std::vector<double> > c1(t1, v1), c2(t2, v2);
+            copy1 >> c1;
+            copy2.unmarshal(c2);
+            CHECK(!copy1.error() && t1 == timestamps && v1 == values);
+            CHECK(!copy2.error() && t2 == timestamps && v2 == values);
+        }
+    }
+
+    {
+        std::cout << ">Columns deserialization failure" << std::endl;
+        std::vector<std::tuple<uint64_t, double> > rows(3, std::make_tuple(uint64_t(1), 2.0));
+        dbustl::Message msg(dbus_message_new_signal("/LoopbackService", "org.dbustl.LoopbackTest", "Columns"));
+        msg << rows;
+        dbustl::Message received(dbus_message_copy(msg.dbus()));
+        //The first column is read, the second one can't be
+        std::vector<uint64_t> timestamps(2, 7);
+        std::vector<std::string> names(2, "seven");
+        dbustl::Columns<std::vector<uint64_t>, std::vector<std::string> > samples(timestamps, names);
+        received >> samples;
+        CHECK(received.error());
+        CHECK(timestamps.size() == 2 && names.size() == 2);
+    }
+
+    {
+        std::cout << ">marshal() against operator<<" << std::endl;
+        std::vector<double> values(5, 0.5);
+        std::map<std::string, dbustl::Variant> props;
+        props["count"] = int32_t(3);
+        props["name"] = std::string("marshal");
+        dbustl::Message msg1(dbus_message_new_method_call("org.dbustl.Loopback", "/LoopbackService", 
+            "org.dbustl.LoopbackTest", "Marshal"));
+        dbustl::Message msg2(dbus_message_copy(msg1.dbus()));
+        dbus_message_set_no_reply(msg1.dbus(), TRUE);
+        dbus_message_set_auto_start(msg1.dbus(), FALSE);
+        dbus_message_set_no_reply(msg2.dbus(), TRUE);
+        dbus_message_set_auto_start(msg2.dbus(), FALSE);
+#ifdef DBUS_HEADER_FLAG_ALLOW_INTERACTIVE_AUTHORIZATION
+        dbus_message_set_allow_interactive_authorization(msg1.dbus(), TRUE);
+        dbus_message_set_allow_interactive_authorization(msg2.dbus(), TRUE);
+#endif
+        msg1 << int32_t(1) << std::string("two") << values << props;
+        msg2.marshal(int32_t(1), std::string("two"), values, props);
+        CHECK(!msg1.error() && !msg2.error());
+        CHECK(dbus_message_get_serial(msg2.dbus()) == 0);
+        dbus_message_set_serial(msg1.dbus(), 7);
+        dbus_message_set_serial(msg2.dbus(), 7);
+        char *bytes1, *bytes2;
+        int len1, len2;
+        CHECK(dbus_message_marshal(msg1.dbus(), &bytes1, &len1));
+        CHECK(dbus_message_marshal(msg2.dbus(), &bytes2, &len2));
+        CHECK(len1 == len2 && memcmp(bytes1, bytes2, len1) == 0);
+        dbus_free(bytes1);
+        dbus_free(bytes2);
+    }
+
+#if defined(DBUSTL_UNIX_FD) && defined(__linux__)
+    {
+        //The wire format has no room for descriptors, nor has Variant::serialize()
+        std::cout << ">marshal() and unmarshal() with descriptors" << std::endl;
+        int pipeFds[2];
+        CHECK(pipe(pipeFds) == 0);
+        dbustl::Variant fd((dbustl::UnixFd(pipeFds[0])));
+        CHECK(fd.signature() == std::string("h"));
+        dbustl::Message msg1(dbus_message_new_signal("/LoopbackService", "org.dbustl.LoopbackTest", "Fd"));
+        dbustl::Message msg2(dbus_message_new_signal("/LoopbackService", "org.dbustl.LoopbackTest", "Fd"));
+        msg1 << int32_t(1) << fd;
+        msg2.marshal(int32_t(1), fd);
+        CHECK(msg1.error());
+        CHECK(msg2.error());
+        //The body only holds an index into the descriptors: it must not be read as one
+        dbustl::Message msg3(dbus_message_new_signal("/LoopbackService", "org.dbustl.LoopbackTest", "Fd"));
+        DBusMessageIter it, sub;
+        int one = 1;
+        dbus_message_iter_init_append(msg3.dbus(), &it);
+        dbus_message_iter_append_basic(&it, DBUS_TYPE_INT32, &one);
+        dbus_message_iter_open_container(&it, DBUS_TYPE_VARIANT, "h", &sub);
+        dbus_message_iter_append_basic(&sub, DBUS_TYPE_UNIX_FD, &pipeFds[1]);
+        dbus_message_iter_close_container(&it, &sub);
+        close(pipeFds[1]);
+        dbustl::Message copy1(dbus_message_copy(msg3.dbus())), copy2(dbus_message_copy(msg3.dbus()));
+        int32_t i1, i2;
+        dbustl::Variant v1, v2;
+        copy1 >> i1 >> v1;
+        copy2.unmarshal(i2, v2);
+        CHECK(copy1.error() && copy2.error());
+        CHECK(v2.isNull());
+    }
+#endif
+
+    {
+        //Used by the probes, as libdbus does not tell the body length
+        std::cout << ">body size" << std::endl;
+        std::map<std::string, dbustl::Variant> props;
+        props["count"] = int32_t(3);
+        props["values"] = std::vector<double>(3, 0.5);
+        std::vector<std::tuple<uint8_t, std::string> > rows(2, std::make_tuple(uint8_t(1), std::string("row")));
+        dbustl::Message msg(dbus_message_new_signal("/LoopbackService", "org.dbustl.LoopbackTest", "Size"));
+        CHECK(dbustl::types::__wireBodySize(msg.dbus()) == 0);
+        msg << uint8_t(1) << props << rows << std::string("end");
+#if defined(DBUSTL_UNIX_FD) && defined(__linux__)
+        msg << dbustl::UnixFd(dup(0)) << uint16_t(2);
+#endif
+        dbus_message_set_serial(msg.dbus(), 1);
+        char *bytes;
+        int len;
+        CHECK(dbus_message_marshal(msg.dbus(), &bytes, &len));
+        dbus_uint32_t bodyLength;
+        memcpy(&bodyLength, bytes + 4, 4);
+        dbus_free(bytes);
+        CHECK(dbustl::types::__wireBodySize(msg.dbus()) == bodyLength);
+    }
+
+    {
+        std::cout << ">strings with NULs" << std::endl;
+        const std::string nul("a\0b", 3);
+        dbustl::Message msg1(dbus_message_new_signal("/LoopbackService", "org.dbustl.LoopbackTest", "Nul"));
+        dbustl::Message msg2(dbus_message_new_signal("/LoopbackService", "org.dbustl.LoopbackTest", "Nul"));
+        msg1 << nul;
+        msg2.marshal(nul);
+        CHECK(msg1.error());
+        CHECK(msg2.error());
+        //The next marshal() starts clean
+        dbustl::Message msg3(dbus_message_new_signal("/LoopbackService", "org.dbustl.LoopbackTest", "Nul"));
+        msg3.marshal(std::string("a"));
+        CHECK(!msg3.error());
+    }
+
+    {
+        std::cout << ">duplicate dictionary keys" << std::endl;
+        dbustl::Message msg(dbus_message_new_signal("/LoopbackService", "org.dbustl.LoopbackTest", "Dict"));
+        DBusMessageIter it, dict, entry, values;
+        dbus_message_iter_init_append(msg.dbus(), &it);
+        dbus_message_iter_open_container(&it, DBUS_TYPE_ARRAY, "{sai}", &dict);
+        for(int32_t i = 0; i < 2; ++i) {
+            const char *key = "same";
+            dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+            dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+            dbus_message_iter_open_container(&entry, DBUS_TYPE_ARRAY, "i", &values);
+            dbus_message_iter_append_basic(&values, DBUS_TYPE_INT32, &i);
+            dbus_message_iter_close_container(&entry, &values);
+            dbus_message_iter_close_container(&dict, &entry);
+        }
+        dbus_message_iter_close_container(&it, &dict);
+        dbustl::Message copy1(dbus_message_copy(msg.dbus())), copy2(dbus_message_copy(msg.dbus()));
+        std::map<std::string, std::vector<int32_t> > d1, d2;
+        copy1 >> d1;
+        copy2.unmarshal(d2);
+        CHECK(copy1.error());
+        CHECK(copy2.error());
+        //The second value must not have been appended to the first one
+        CHECK(d2.size() == 1 && d2["same"] == std::vector<int32_t>(1, 0));
+        //The next unmarshal() starts clean
+        dbustl::Message valid(dbus_message_new_signal("/LoopbackService", "org.dbustl.LoopbackTest", "Dict"));
+        valid << d2;
+        dbustl::Message copy3(dbus_message_copy(valid.dbus()));
+        std::map<std::string, std::vector<int32_t> > d3;
+        copy3.unmarshal(d3);
+        CHECK(!copy3.error() && d3 == d2);
+    }
+
+    {
+        //Lengths around the SSE2 and AVX2 block sizes, to go through the vector loops and the tails
+        std::cout << ">whole array conversions" << std::endl;
+        const size_t lengths[] = { 0, 1, 15, 16, 17, 31, 32, 33 };
+        for(size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l) {
+            const size_t n = lengths[l];
+            std::vector<float> floats(n + 1);
+            std::vector<double> doubles(n + 1), narrowed(n + 1);
+            bool bools[33], boolsBack[34];
+            std::vector<dbus_uint32_t> wireBools(n + 1);
+            std::vector<signed char> chars(n + 1);
+            std::vector<int16_t> shorts(n + 1), wideShorts(n + 1);
+            for(size_t i = 0; i < n; ++i) {
+                floats[i] = (i % 2 ? -1.0f : 1.0f) * (i + 0.25f) / 3;
+                //Not representable as a float: rounded, or out of range
+                narrowed[i] = i % 3 ? 1.0 / (i + 3) : (i % 2 ? -1e300 : 1e-300);
+                bools[i] = i % 3 == 1;
+                //Any non zero value is true
+                wireBools[i] = i % 4 == 0 ? 0 : dbus_uint32_t(1) << (i % 32);
+                chars[i] = static_cast<signed char>(i * 37 - 128);
+                //Truncated to their low byte, sign included
+                wideShorts[i] = static_cast<int16_t>(i * 997 - 16000);
+            }
+            //Guards, which must not be overwritten
+            doubles[n] = 42;
+            floats[n] = 42;
+            boolsBack[n] = true;
+            wireBools[n] = 42;
+            shorts[n] = 42;
+            chars[n] = 42;
+
+            dbustl::types::__wireConvert(&doubles[0], &floats[0], n);
+            std::vector<float> floatsBack(n + 1, 42);
+            dbustl::types::__wireConvert(&floatsBack[0], &doubles[0], n);
+            bool ok = doubles[n] == 42 && floatsBack == floats;
+            for(size_t i = 0; i < n; ++i) {
+                ok = ok && doubles[i] == static_cast<double>(floats[i]);
+            }
+            CHECK(ok);
+
+            dbustl::types::__wireConvert(&floatsBack[0], &narrowed[0], n);
+            ok = floatsBack[n] == 42;
+            for(size_t i = 0; i < n; ++i) {
+                const float expected = static_cast<float>(narrowed[i]);
+                ok = ok && std::memcmp(&floatsBack[i], &expected, sizeof(float)) == 0;
+            }
+            CHECK(ok);
+
+            std::vector<dbus_uint32_t> boolsOut(n + 1, 42);
+            dbustl::types::__wireConvert(&boolsOut[0], bools, n);
+            dbustl::types::__wireConvert(boolsBack, &boolsOut[0], n);
+            ok = boolsOut[n] == 42;
+            for(size_t i = 0; i < n; ++i) {
+                ok = ok && boolsOut[i] == dbus_uint32_t(bools[i]) && boolsBack[i] == bools[i];
+            }
+            dbustl::types::__wireConvert(boolsBack, &wireBools[0], n);
+            ok = ok && boolsBack[n];
+            for(size_t i = 0; i < n; ++i) {
+                ok = ok && boolsBack[i] == (wireBools[i] != 0);
+            }
+            CHECK(ok);
+
+            dbustl::types::__wireConvert(&shorts[0], &chars[0], n);
+            std::vector<signed char> charsBack(n + 1, 42);
+            dbustl::types::__wireConvert(&charsBack[0], &shorts[0], n);
+            ok = shorts[n] == 42 && charsBack == chars;
+            for(size_t i = 0; i < n; ++i) {
+                ok = ok && shorts[i] == chars[i];
+            }
+            dbustl::types::__wireConvert(&charsBack[0], &wideShorts[0], n);
+            ok = ok && charsBack[n] == 42;
+            for(size_t i = 0; i < n; ++i) {
+                ok = ok && charsBack[i] == static_cast<signed char>(wideShorts[i]);
+            }
+            CHECK(ok);
+
+            //Same through messages, for both deserialization paths
+            floats.resize(n);
+            chars.resize(n);
+            dbustl::Message msg(dbus_message_new_signal("/LoopbackService", "org.dbustl.LoopbackTest", "Arrays"));
+            msg << floats << chars;
+            CHECK(!msg.error() && std::string(dbus_message_get_signature(msg.dbus())) == "adan");
+            dbustl::Message copy1(dbus_message_copy(msg.dbus())), copy2(dbus_message_copy(msg.dbus()));
+            std::vector<float> f1, f2;
+            std::vector<signed char> c1, c2;
+            copy1 >> f1 >> c1;
+            copy2.unmarshal(f2, c2);
+            CHECK(!copy1.error() && f1 == floats && c1 == chars);
+            CHECK(!copy2.error() && f2 == floats && c2 == chars);
+        }
+    }
+
+    {
+        std::cout << ">SignalFilter rules" << std::endl;
+        CHECK(dbustl::SignalFilter().arg(0, "it's").rule("/Filter", "Changed") 
+            == "type='signal',member='Changed',path='/Filter',arg0='it'\\''s'");
+        //Arguments come in order, whatever order they are given in
+        dbustl::SignalFilter args = dbustl::SignalFilter().arg(3, "d").arg(1, "b");
+        CHECK(args.rule("/Filter", "") == "type='signal',path='/Filter',arg1='b',arg3='d'");
+        CHECK(dbustl::SignalFilter().arg0Namespace("org.example").pathNamespace().rule("/Filter", "Changed")
+            == "type='signal',member='Changed',path_namespace='/Filter',arg0namespace='org.example'");
+        CHECK(dbustl::SignalFilter().arg(63, "x").isValid());
+        CHECK(!dbustl::SignalFilter().arg(64, "x").isValid());
+    }
+
+    {
+        std::cout << ">SignalFilter matches" << std::endl;
+        dbustl::SignalFilter args = dbustl::SignalFilter().arg(3, "d").arg(1, "b");
+        const char *signals[][5] = {
+            {"1", "a", "b", "c", "d"},
+            {"0", "a", "b", "c", "e"},
+            {"0", "a", "x", "c", "d"},
+            {"0", "a", "b", "c", NULL},
+        };
+        for(int i = 0; i < 4; ++i) {
+            DBusMessage *signal = stringSignal("/Filter", signals[i][1], signals[i][2], signals[i][3], signals[i][4]);
+            CHECK(args.matches(signal, "/Filter") == (signals[i][0][0] == '1'));
+            dbus_message_unref(signal);
+        }
+
+        dbustl::SignalFilter ns = dbustl::SignalFilter().arg0Namespace("org.example");
+        const char *names[] = {"org.example", "org.example.Device", "org.examples", "org"};
+        for(int i = 0; i < 4; ++i) {
+            DBusMessage *signal = stringSignal("/Filter", names[i]);
+            CHECK(ns.matches(signal, "/Filter") == (i < 2));
+            dbus_message_unref(signal);
+        }
+
+        dbustl::SignalFilter below = dbustl::SignalFilter().pathNamespace();
+        const char *paths[] = {"/Filter", "/Filter/Device", "/FilterDevice", "/"};
+        for(int i = 0; i < 4; ++i) {
+            DBusMessage *signal = stringSignal(paths[i], "a");
+            CHECK(below.matches(signal, "/Filter") == (i < 2));
+            CHECK(dbustl::SignalFilter().interface("org.dbustl.LoopbackTest").matches(signal, "/Filter") == (i == 0));
+            dbus_message_unref(signal);
+        }
+    }
+
+    {
+        std::cout << ">setSignalFilter" << std::endl;
+        dbustl::DBusObject service("/FilterService", "org.dbustl.LoopbackTest", server);
+        dbustl::SignalEmitter<std::string> changed = service.exportSignal<std::string>("Changed");
+        dbustl::ObjectProxy proxy(client, "/FilterService", dbus_bus_get_unique_name(server->dbus()));
+        std::vector<std::string> values;
+        proxy.setSignalHandler("Changed", ChangedHandler(&values));
+        proxy.setSignalFilter("Changed", dbustl::SignalFilter().arg(0, "eth0"));
+        changed("eth1");
+        changed("eth0");
+        server->flush();
+        CHECK(dispatchUntil(client->dbus(), "Changed"));
+        CHECK(values.size() == 1 && values[0] == "eth0");
+
+        //Rejected by the bus daemon, or by the proxy: the rule in place stays
+        bool thrown = false;
+        try {
+            proxy.setSignalFilter("Changed", dbustl::SignalFilter().interface("not an interface"));
+        }
+        catch(const dbustl::DBusException&) {
+            thrown = true;
+        }
+        CHECK(thrown);
+        thrown = false;
+        try {
+            proxy.setSignalFilter("Changed", dbustl::SignalFilter().arg(64, "eth1"));
+        }
+        catch(const dbustl::DBusException&) {
+            thrown = true;
+        }
+        CHECK(thrown);
+        changed("eth1");
+        changed("eth0");
+        server->flush();
+        CHECK(dispatchUntil(client->dbus(), "Changed"));
+        CHECK(values.size() == 2 && values[1] == "eth0");
+
+        //Swapped for another rule
+        proxy.setSignalFilter("Changed", dbustl::SignalFilter().arg(0, "eth1"));
+        changed("eth0");
+        changed("eth1");
+        server->flush();
+        CHECK(dispatchUntil(client->dbus(), "Changed"));
+        CHECK(values.size() == 3 && values[2] == "eth1");
+    }
+
+    {
+        std::cout << ">setSignalFilter with a handler of all signals" << std::endl;
+        dbustl::DBusObject service("/FallThroughService", "org.dbustl.LoopbackTest", server);
+        dbustl::SignalEmitter<std::string> changed = service.exportSignal<std::string>("Changed");
+        dbustl::ObjectProxy proxy(client, "/FallThroughService", dbus_bus_get_unique_name(server->dbus()));
+        std::vector<std::string> exact, generic;
+        proxy.setSignalHandler("Changed", ChangedHandler(&exact));
+        proxy.setSignalHandler("", ChangedHandler(&generic));
+        proxy.setSignalFilter("Changed", dbustl::SignalFilter().arg(0, "eth0"));
+        changed("eth1");
+        changed("eth0");
+        server->flush();
+        CHECK(dispatchUntil(client->dbus(), "Changed"));
+        CHECK(dispatchUntil(client->dbus(), "Changed"));
+        CHECK(exact.size() == 1 && exact[0] == "eth0");
+        CHECK(generic.size() == 1 && generic[0] == "eth1");
+    }
+
+    {
+        //The handler of Outer runs the one of Inner, on the other connection with the same watchdog
+        std::cout << ">DispatchWatchdog" << std::endl;
+        RecordingWatchdog watchdog(10000);
+        client->setDispatchWatchdog(&watchdog);
+        server->setDispatchWatchdog(&watchdog);
+        dbustl::DBusObject serverObject("/WatchdogService", "org.dbustl.LoopbackTest", server);
+        dbustl::DBusObject clientObject("/WatchdogClient", "org.dbustl.LoopbackTest", client);
+        dbustl::SignalEmitter<std::string> outer = serverObject.exportSignal<std::string>("Outer");
+        dbustl::SignalEmitter<std::string> inner = clientObject.exportSignal<std::string>("Inner");
+        dbustl::ObjectProxy clientProxy(client, "/WatchdogService", dbus_bus_get_unique_name(server->dbus()));
+        dbustl::ObjectProxy serverProxy(server, "/WatchdogClient", dbus_bus_get_unique_name(client->dbus()));
+        bool innerDispatched = false;
+        clientProxy.setSignalHandler("Outer", [&](dbustl::Message&) {
+            struct timespec slow = { 0, 20000000 };
+            nanosleep(&slow, NULL);
+            inner("fast");
+            client->flush();
+            innerDispatched = dispatchUntil(server->dbus(), "Inner");
+        });
+        serverProxy.setSignalHandler("Inner", [](dbustl::Message&) {});
+        outer("slow");
+        server->flush();
+        CHECK(dispatchUntil(client->dbus(), "Outer"));
+        CHECK(innerDispatched);
+        CHECK(watchdog.count() == 2);
+        CHECK(watchdog.stalls.size() == 1 && watchdog.stalls[0] == "Outer");
+        CHECK(watchdog.maxDuration() >= 20000);
+        int bucket = 0;
+        while(bucket < dbustl::DispatchWatchdog::HistogramSize - 1 && (watchdog.maxDuration() >> bucket)) {
+            ++bucket;
+        }
+        CHECK(watchdog.histogram(bucket) == 1);
+        unsigned long total = 0;
+        for(int i = 0; i < dbustl::DispatchWatchdog::HistogramSize; ++i) {
+            total += watchdog.histogram(i);
+        }
+        CHECK(total == 2);
+        client->setDispatchWatchdog(NULL);
+        server->setDispatchWatchdog(NULL);
+    }
+
+    {
+        std::cout << ">SignalEmitter" << std::endl;
+        dbustl::DBusObject service("/EmitterService", "org.dbustl.LoopbackTest", server);
+        dbustl::SignalEmitter<uint32_t, std::string> status = 
+            service.exportSignal<uint32_t, std::string>("Status", "org.dbustl.AlternateTest");
+        dbustl::SignalEmitter<uint32_t, std::string> copy(status), assigned;
+        CHECK(!status.isNull() && !copy.isNull() && assigned.isNull());
+        assigned = copy;
+        CHECK(!assigned.isNull());
+        dbustl::ObjectProxy proxy(client, "/EmitterService", dbus_bus_get_unique_name(server->dbus()));
+        std::vector<std::string> texts;
+        std::vector<dbus_uint32_t> serials;
+        bool headersOk = true;
+        proxy.setSignalHandler("Status", [&](dbustl::Message& signal) {
+            uint32_t code = 0;
+            std::string text;
+            signal >> code >> text;
+            headersOk = headersOk && !signal.error() && code == texts.size() + 1
+                && std::string(dbus_message_get_path(signal.dbus())) == "/EmitterService"
+                && std::string(dbus_message_get_interface(signal.dbus())) == "org.dbustl.AlternateTest"
+                && std::string(dbus_message_get_signature(signal.dbus())) == "us";
+            texts.push_back(text);
+            serials.push_back(dbus_message_get_serial(signal.dbus()));
+        });
+        //Each emission sends a copy of the prepared message, shared by the copies of the emitter
+        status(1, "one");
+        copy(2, "two");
+        assigned(3, "three");
+        server->flush();
+        for(int i = 0; i < 3; ++i) {
+            CHECK(dispatchUntil(client->dbus(), "Status"));
+        }
+        CHECK(headersOk);
+        CHECK(texts.size() == 3 && texts[0] == "one" && texts[1] == "two" && texts[2] == "three");
+        CHECK(serials.size() == 3 && serials[0] != serials[1] && serials[1] != serials[2]);
+    }
+
+    {
+        std::cout << ">typed signal handlers" << std::endl;
+        dbustl::DBusObject service("/TypedService", "org.dbustl.LoopbackTest", server);
+        dbustl::SignalEmitter<uint32_t, std::string> typed = service.exportSignal<uint32_t, std::string>("Typed");
+        dbustl::ObjectProxy proxy(client, "/TypedService", dbus_bus_get_unique_name(server->dbus()));
+        std::vector<std::string> texts, others;
+        uint32_t codes = 0;
+        proxy.setSignalHandler<uint32_t, std::string>("Typed", [&](const uint32_t& code, const std::string& text) {
+            codes += code;
+            texts.push_back(text);
+        });
+        proxy.setSignalHandler("", ChangedHandler(&others));
+        typed(5, "five");
+        //Another signature: left to the handler of all signals, without being read
+        DBusMessage *untyped = stringSignal("/TypedService", "untyped");
+        dbus_message_set_member(untyped, "Typed");
+        dbus_connection_send(server->dbus(), untyped, NULL);
+        dbus_message_unref(untyped);
+        typed(7, "seven");
+        server->flush();
+        for(int i = 0; i < 3; ++i) {
+            CHECK(dispatchUntil(client->dbus(), "Typed"));
+        }
+        CHECK(codes == 12 && texts.size() == 2 && texts[0] == "five" && texts[1] == "seven");
+        CHECK(others.size() == 1 && others[0] == "untyped");
+
+        proxy.removeSignalHandler("Typed");
+        typed(9, "nine");
+        server->flush();
+        CHECK(dispatchUntil(client->dbus(), "Typed"));
+        CHECK(codes == 12 && texts.size() == 2);
+        CHECK(others.size() == 2);
+    }
+
+    {
+        std::cout << ">PreparedCall" << std::endl;
+        dbustl::ObjectProxy proxy(client, "/PreparedService", dbus_bus_get_unique_name(server->dbus()));
+        proxy.setInterface("org.dbustl.LoopbackTest");
+        dbustl::PreparedCall<uint32_t, std::string, std::vector<double> > prepared(&proxy, "SetName");
+        std::vector<double> values(3, 0.5);
+        for(int i = 0; i < 2; ++i) {
+            //The message ObjectProxy::call() would send, serial aside
+            dbustl::Message expected(proxy.createMethodCall("SetName"));
+            expected << uint32_t(i) << std::string("eth0") << values;
+            dbustl::Message actual(prepared.createMethodCall(uint32_t(i), "eth0", values));
+            dbus_message_set_serial(expected.dbus(), 1);
+            dbus_message_set_serial(actual.dbus(), 1);
+            char *expectedBytes, *actualBytes;
+            int expectedSize, actualSize;
+            CHECK(dbus_message_marshal(expected.dbus(), &expectedBytes, &expectedSize));
+            CHECK(dbus_message_marshal(actual.dbus(), &actualBytes, &actualSize));
+            CHECK(expectedSize == actualSize && memcmp(expectedBytes, actualBytes, actualSize) == 0);
+            dbus_free(expectedBytes);
+            dbus_free(actualBytes);
+        }
+        //Interface given to the PreparedCall, rather than set on the proxy
+        dbustl::PreparedCall<uint32_t> other(&proxy, "SetId", "org.dbustl.OtherTest");
+        dbustl::Message sent(other.createMethodCall(7));
+        dbustl::Message call(dbus_message_copy(sent.dbus()));
+        uint32_t id = 0;
+        call >> id;
+        CHECK(call.interface() == "org.dbustl.OtherTest" && call.member() == "SetId" && id == 7);
+        CHECK(std::string(dbus_message_get_path(call.dbus())) == "/PreparedService");
+        CHECK(std::string(dbus_message_get_destination(call.dbus())) == dbus_bus_get_unique_name(server->dbus()));
+    }
+
+    {
+        std::cout << ">emitSignalTo" << std::endl;
+        //Neither client nor other listen to these signals: the bus daemon gives them unicast signals anyway
+        dbustl::Connection other(DBUS_BUS_SESSION);
+        dbustl::DBusObject service("/UnicastService", "org.dbustl.LoopbackTest", server);
+        service.exportSignal<uint32_t>("Unicast");
+        service.exportSignal<uint32_t>("Multicast");
+        service.emitSignalTo(dbus_bus_get_unique_name(client->dbus()), "Unicast", uint32_t(1));
+        std::vector<std::string> destinations;
+        destinations.push_back(dbus_bus_get_unique_name(client->dbus()));
+        destinations.push_back(dbus_bus_get_unique_name(other.dbus()));
+        service.emitSignalTo(destinations, "Multicast", uint32_t(2));
+        server->flush();
+        CHECK(dispatchUntil(client->dbus(), "Unicast"));
+        CHECK(dispatchUntil(client->dbus(), "Multicast"));
+        CHECK(dispatchUntil(other.dbus(), "Multicast"));
+    }
+#endif
+
+#ifdef HAVE_SEALED_FILES
+    {
+        std::cout << ">out of band arrays" << std::endl;
+        std::vector<uint8_t> small(100, 1), big(4096);
+        for(size_t i = 0; i < big.size(); ++i) {
+            big[i] = i % 251;
+        }
+        dbustl::Message msg(dbus_message_new_signal("/LoopbackService", "org.dbustl.LoopbackTest", "Arrays"));
+        msg.setOutOfBandThreshold(1024);
+        msg << small << big;
+        CHECK(!msg.error() && std::string(dbus_message_get_signature(msg.dbus())) == "ayh");
+
+        //The receiver did not opt in
+        dbustl::Message rejected(dbus_message_copy(msg.dbus()));
+        std::vector<uint8_t> out1, out2;
+        rejected >> out1 >> out2;
+        CHECK(out1 == small && rejected.error() && out2.empty());
+
+        dbustl::Message accepted(dbus_message_copy(msg.dbus()));
+        accepted.setOutOfBandLimit(big.size());
+        out1.clear();
+        accepted >> out1 >> out2;
+        CHECK(!accepted.error() && out1 == small && out2 == big);
+
+        dbustl::Message reused(dbus_message_copy(msg.dbus()));
+        reused.setOutOfBandLimit(big.size());
+        out2.assign(3, 0);
+        reused >> out1 >> dbustl::reuse(out2);
+        CHECK(!reused.error() && out2 == big);
+
+        dbustl::Message tooBig(dbus_message_copy(msg.dbus()));
+        tooBig.setOutOfBandLimit(big.size() - 1);
+        out2.clear();
+        tooBig >> out1 >> out2;
+        CHECK(tooBig.error() && out2.empty());
+    }
+
+    {
+        std::cout << ">out of band arrays in files sealed wrongly" << std::endl;
+        const int seals[] = {0, F_SEAL_WRITE, F_SEAL_SHRINK, F_SEAL_SHRINK | F_SEAL_WRITE};
+        const size_t sizes[] = {4096, 4096, 4096, size_t(DBUS_MAXIMUM_ARRAY_LENGTH) + 4096};
+        for(int i = 0; i < 4; ++i) {
+            dbustl::UnixFd fd(sealedFile(sizes[i], seals[i]));
+            CHECK(fd.get() >= 0);
+            dbustl::Message msg(dbus_message_new_signal("/LoopbackService", "org.dbustl.LoopbackTest", "Arrays"));
+            msg << fd;
+            dbustl::Message received(dbus_message_copy(msg.dbus()));
+            received.setOutOfBandLimit(DBUS_MAXIMUM_ARRAY_LENGTH);
+            std::vector<uint8_t> out;
+            received >> out;
+            CHECK(received.error() && out.empty());
+        }
+    }
+
+    if(dbus_connection_can_send_type(client->dbus(), DBUS_TYPE_UNIX_FD)) {
+        std::cout << ">out of band arrays in method calls" << std::endl;
+        UploadService service(server);
+        service.setOutOfBandThreshold("Upload", 1024);
+        std::vector<uint8_t> big(4096, 7);
+        const char *members[] = {"Upload", "InlineUpload", "Upload"};
+        size_t expected[] = {big.size(), 0, 0};
+        for(int i = 0; i < 3; ++i) {
+            //The last time, the array is over the limit of the service
+            if(i == 2) {
+                service.setOutOfBandLimit(big.size() - 1);
+            }
+            service.received = 0;
+            dbustl::Message call(dbus_message_new_method_call(dbus_bus_get_unique_name(server->dbus()), 
+                "/UploadService", "org.dbustl.LoopbackTest", members[i]));
+            call.setOutOfBandThreshold(1024);
+            call << big;
+            CHECK(std::string(dbus_message_get_signature(call.dbus())) == "h");
+            dbus_message_set_no_reply(call.dbus(), TRUE);
+            dbus_connection_send(client->dbus(), call.dbus(), NULL);
+            dbus_connection_flush(client->dbus());
+            CHECK(dispatchUntil(server->dbus(), members[i]));
+            CHECK(service.received == expected[i]);
+        }
+    }
+
+    if(dbus_connection_can_send_type(client->dbus(), DBUS_TYPE_UNIX_FD)) {
+        std::cout << ">SignalChannel" << std::endl;
+        dbustl::DBusObject service("/ChannelService", "org.dbustl.LoopbackTest", server);
+        dbustl::SignalChannel<uint64_t, double> samples(&service, "Sample", 4);
+        samples.setBroadcast(false);
+        dbustl::ObjectProxy proxy(client, "/ChannelService", dbus_bus_get_unique_name(server->dbus()));
+
+        //The receiver opens its channel with a blocking call
+        std::vector<uint64_t> timestamps;
+        Dispatch dispatch = { server->dbus(), "Sample" };
+        pthread_t thread;
+        pthread_create(&thread, 0, dispatchThread, &dispatch);
+        dbustl::SignalChannelReceiver<uint64_t, double> receiver(&proxy, "Sample", 
+            [&timestamps](const uint64_t& timestamp, const double&) { timestamps.push_back(timestamp); });
+        pthread_join(thread, 0);
+        CHECK(receiver.isOpen() && receiver.fd() >= 0 && samples.subscribers() == 1);
+
+        for(uint64_t t = 1; t <= 3; ++t) {
+            samples.emit(t, t * 0.5);
+        }
+        CHECK(receiver.dispatch() == 3);
+        CHECK(timestamps.size() == 3 && timestamps[0] == 1 && timestamps[2] == 3);
+
+        //The receiver went to sleep: the next signal wakes it up
+        CHECK(!isReadable(receiver.fd()));
+        samples.emit(4, 2.0);
+        CHECK(isReadable(receiver.fd()));
+        CHECK(receiver.dispatch() == 1 && timestamps.back() == 4);
+
+        //Full ring
+        for(uint64_t t = 5; t <= 10; ++t) {
+            samples.emit(t, t * 0.5);
+        }
+        CHECK(samples.dropped() == 2);
+        CHECK(receiver.dispatch() == 4 && timestamps.back() == 8);
+
+        //A subscriber that dies without telling: its ring is freed once full, without counting drops
+        int fds[2];
+        CHECK(pipe(fds) == 0);
+        CHECK(openChannel(client->dbus(), server->dbus(), "Sample", fds[0]));
+        close(fds[0]);
+        close(fds[1]);
+        CHECK(samples.subscribers() == 2);
+        for(uint64_t t = 11; t <= 14; ++t) {
+            samples.emit(t, t * 0.5);
+        }
+        CHECK(receiver.dispatch() == 4);
+        samples.emit(15, 7.5);
+        CHECK(samples.subscribers() == 1 && samples.dropped() == 2);
+        CHECK(receiver.dispatch() == 1 && timestamps.back() == 15);
+
+        //Channels per connection
+        samples.setMaxChannelsPerPeer(2);
+        int first[2], second[2];
+        CHECK(pipe(first) == 0 && pipe(second) == 0);
+        CHECK(openChannel(client->dbus(), server->dbus(), "Sample", first[0]));
+        CHECK(!openChannel(client->dbus(), server->dbus(), "Sample", second[0]));
+        close(first[1]);
+        CHECK(openChannel(client->dbus(), server->dbus(), "Sample", second[0]));
+        CHECK(samples.subscribers() == 2);
+        close(first[0]);
+        close(second[0]);
+        close(second[1]);
+
+        //No channel for this signal: the receiver listens on the bus
+        dbustl::SignalEmitter<uint32_t> status = service.exportSignal<uint32_t>("Status");
+        uint32_t lastStatus = 0;
+        dispatch.member = "Status";
+        pthread_create(&thread, 0, dispatchThread, &dispatch);
+        dbustl::SignalChannelReceiver<uint32_t> statusReceiver(&proxy, "Status", 
+            [&lastStatus](const uint32_t& value) { lastStatus = value; });
+        pthread_join(thread, 0);
+        CHECK(!statusReceiver.isOpen() && statusReceiver.fd() < 0);
+        status(7);
+        server->flush();
+        CHECK(dispatchUntil(client->dbus(), "Status"));
+        CHECK(lastStatus == 7);
+    }
+#endif
+
+    delete client;
+    delete server;
+    return failures ? 1 : 0;
+}
@@ -89,7 +89,7 @@ public:
         
    #ifdef DBUSTL_CXX0X
         exportSignal<std::string>("TestSignal");
-        exportSignal<std::string, int>("TestSignal2");
+        _testSignal2 = exportSignal<std::string, int>("TestSignal2");
         exportSignal<std::string>("TestSignal3", "com.example.AlternateInterface");
    #else
         exportSignal("TestSignal", dbustl::SignatureBuilder<std::string>());
@@ -306,9 +306,13 @@ private:
 
     void test_signal2()
     {
+#ifdef DBUSTL_CXX0X
+        _testSignal2("Signal 2 string value", -1);
+#else
         dbustl::Message signal = createSignal("TestSignal2");
         signal << "Signal 2 string value" << -1;
         emitSignal(signal);
+#endif
     };
 
     void test_signal3()
@@ -327,6 +331,10 @@ private:
         g_main_loop_quit(mainloop);
     };
 
+#ifdef DBUSTL_CXX0X
+    dbustl::SignalEmitter<std::string, int> _testSignal2;
+#endif
+
 public:
     void test_unexistingsignal()
     {
@@ -364,6 +372,10 @@ int main()
         
     assert(session->isConnected());
     
+    //Big enough threshold not to be hit, we just want the statistics
+    dbustl::DispatchWatchdog watchdog(60 * 1000000);
+    session->setDispatchWatchdog(&watchdog);
+
     session->busRequestName("com.example.SampleService");
     
     TestServiceClass srv(session);
@@ -398,6 +410,11 @@ int main()
     
     g_main_loop_run(mainloop);        
     session->busReleaseName("com.example.SampleService");
+    session->setDispatchWatchdog(0);
+
+    //At least stop() went through the watchdog
+    assert(watchdog.count() > 0);
+    assert(watchdog.maxDuration() < watchdog.threshold());
 
     g_main_loop_unref(mainloop);
 
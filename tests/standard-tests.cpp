@@ -29,6 +29,8 @@
 
 #include <cassert>
 
+#include <unistd.h>
+
 #ifdef DBUSTL_NO_EXCEPTIONS
     #define TRY
     #define CATCH(ex, handler) if(pythonObjectProxy.hasError()) { ex = pythonObjectProxy.error(); handler }
@@ -661,6 +663,115 @@ int run_vt_tests()
         )
     }
 
+    {
+        std::cout << ">Wire format marshalling and unmarshalling" << std::endl;
+        dbustl::ObjectProxy pythonObjectProxy(session, "/PythonServerObject", "com.example.SampleService");
+        TRY {
+            pythonObjectProxy.setInterface("com.example.SampleInterface");
+            typedef std::map<uint32_t, std::tuple<std::vector<std::string>, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t> > Arg;
+            Arg in, out;
+            std::get<0>(in[0]).push_back("String");
+            std::get<5>(in[1]) = 6;
+            dbustl::Message callMsg = pythonObjectProxy.createMethodCall("test_struct6");
+            callMsg.marshal(in);
+            dbustl::Message callReply = pythonObjectProxy.call(callMsg);
+            dbustl::Message reply1 = callReply;
+            reply1.unmarshal(out);
+            assert(!reply1.error() && in == out);
+            dbustl::Message reply2(dbus_message_copy(callReply.dbus()));
+            assert(std::get<0>(reply2.read<Arg>()) == in);
+            //Signature mismatch: unmarshal() fails, extract() converts
+            std::map<uint64_t, std::tuple<std::vector<std::string>, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t> > converted;
+            dbustl::Message reply3(dbus_message_copy(callReply.dbus()));
+            reply3.unmarshal(converted);
+            assert(reply3.error());
+            dbustl::Message reply4(dbus_message_copy(callReply.dbus()));
+            reply4.extract(std::tie(converted));
+            assert(!reply4.error() && converted.size() == 2 && std::get<5>(converted[1]) == 6);
+        }
+        CATCH(const std::exception& e,
+            std::cerr << e.what() << std::endl;
+            return 1;
+        )
+    }
+
+    {
+        std::cout << ">Columns" << std::endl;
+        dbustl::ObjectProxy pythonObjectProxy(session, "/PythonServerObject", "com.example.SampleService");
+        TRY {
+            pythonObjectProxy.setInterface("com.example.SampleInterface");
+            std::vector<uint64_t> timestamps, outTimestamps;
+            std::vector<double> values, outValues;
+            for(int i = 0; i < 100; ++i) {
+                timestamps.push_back(1000 + i);
+                values.push_back(i / 2.0);
+            }
+            dbustl::Columns<std::vector<uint64_t>, std::vector<double> > in(timestamps, values);
+            dbustl::Columns<std::vector<uint64_t>, std::vector<double> > out(outTimestamps, outValues);
+            pythonObjectProxy.call("test_array_of_samples", in, &out); 
+            assert(outTimestamps == timestamps && outValues == values);
+            outTimestamps.clear();
+            outValues.clear();
+            dbustl::Message callMsg = pythonObjectProxy.createMethodCall("test_array_of_samples");
+            callMsg.marshal(in);
+            dbustl::Message reply = pythonObjectProxy.call(callMsg);
+            reply.unmarshal(out);
+            assert(!reply.error() && outTimestamps == timestamps && outValues == values);
+        }
+        CATCH(const std::exception& e,
+            std::cerr << e.what() << std::endl;
+            return 1;
+        )
+    }
+
+    {
+        std::cout << ">Dictionary of variants" << std::endl;
+        dbustl::ObjectProxy pythonObjectProxy(session, "/PythonServerObject", "com.example.SampleService");
+        TRY {
+            pythonObjectProxy.setInterface("com.example.SampleInterface");
+            std::map<std::string, dbustl::Variant> in, out;
+            in["Name"] = "eth0";
+            in["Mtu"] = 1500;
+            in["Up"] = true;
+            in["Addresses"] = std::vector<std::string>(2, "192.168.1.2");
+            pythonObjectProxy.call("test_dict_of_variants", in, &out); 
+            assert(out.size() == 4 && out["Name"].get<std::string>() == "eth0");
+            assert(out["Mtu"].get<int64_t>() == 1500 && out["Up"].get<bool>());
+            assert(out["Addresses"].get<std::vector<std::string> >() == std::vector<std::string>(2, "192.168.1.2"));
+            out.clear();
+            dbustl::Message callMsg = pythonObjectProxy.createMethodCall("test_dict_of_variants");
+            callMsg.marshal(in);
+            dbustl::Message reply = pythonObjectProxy.call(callMsg);
+            reply.unmarshal(out);
+            assert(!reply.error() && std::string(out["Addresses"].signature()) == "as");
+        }
+        CATCH(const std::exception& e,
+            std::cerr << e.what() << std::endl;
+            return 1;
+        )
+    }
+
+#ifdef DBUS_TYPE_UNIX_FD
+    {
+        std::cout << ">Shared buffer" << std::endl;
+        dbustl::ObjectProxy pythonObjectProxy(session, "/PythonServerObject", "com.example.SampleService");
+        TRY {
+            pythonObjectProxy.setInterface("com.example.SampleInterface");
+            std::string frame(1 << 20, 'x');
+            dbustl::SharedBuffer in(frame.data(), frame.size()), out;
+            assert(!in.isNull() && in.isSealed());
+            pythonObjectProxy.call("test_unix_fd", in, &out); 
+            const dbustl::SharedBuffer& received = out;
+            assert(received.size() == frame.size() && std::string(received.data(), received.size()) == frame);
+            assert(received.fd().get() != in.fd().get());
+        }
+        CATCH(const std::exception& e,
+            std::cerr << e.what() << std::endl;
+            return 1;
+        )
+    }
+#endif
+
     {
         std::cout << ">array of string " << std::endl;
         dbustl::ObjectProxy pythonObjectProxy(session, "/PythonServerObject", "com.example.SampleService");
@@ -948,6 +1059,38 @@ int main()
             return 1;
         )
     }
+
+    {
+        std::cout << ">NOVT: traffic recording" << std::endl;
+        dbustl::Connection conn(DBUS_BUS_SESSION);
+        dbustl::ObjectProxy pythonObjectProxy(&conn, "/PythonServerObject", "com.example.SampleService");
+        TRY {
+            pythonObjectProxy.setInterface("com.example.SampleInterface");
+            conn.startRecording("standard-tests-traffic.log");
+            assert(conn.isRecording());
+            dbustl::Message callMsg = pythonObjectProxy.createMethodCall("test_boolean");
+            callMsg << false;
+            pythonObjectProxy.call(callMsg);
+            conn.stopRecording();
+        }
+        CATCH(const std::exception& e,
+            std::cerr << e.what() << std::endl;
+            return 1;
+        )
+        dbustl::MessageLogReader log;
+        dbustl::MessageLogReader::Entry entry;
+        assert(log.open("standard-tests-traffic.log"));
+        assert(log.next(entry));
+        assert(entry.sent);
+        assert(dbus_message_is_method_call(entry.message, "com.example.SampleInterface", "test_boolean"));
+        dbus_message_unref(entry.message);
+        assert(log.next(entry));
+        assert(!entry.sent);
+        assert(dbus_message_get_type(entry.message) == DBUS_MESSAGE_TYPE_METHOD_RETURN);
+        dbus_message_unref(entry.message);
+        assert(!log.next(entry));
+        unlink("standard-tests-traffic.log");
+    }
     return 0;
 }
 
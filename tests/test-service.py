@@ -145,6 +145,21 @@ class SomeObject(dbus.service.Object):
     def test_struct6(self, data):
         return data
 
+    @dbus.service.method("com.example.SampleInterface",
+                         in_signature='a(td)', out_signature='a(td)')
+    def test_array_of_samples(self, data):
+        return data
+
+    @dbus.service.method("com.example.SampleInterface",
+                         in_signature='a{sv}', out_signature='a{sv}')
+    def test_dict_of_variants(self, data):
+        return data
+
+    @dbus.service.method("com.example.SampleInterface",
+                         in_signature='h', out_signature='h')
+    def test_unix_fd(self, fd):
+        return fd
+
     @dbus.service.method("com.example.SampleInterface",
                          in_signature='', out_signature='')
     def test_sleep_2s(self):
@@ -164,6 +179,7 @@ class SomeObject(dbus.service.Object):
         self.exampleSignal2()
         self.exampleSignal3()
         self.exampleSignal4()
+        self.exampleSignal5(5, "Signal 5 value")
 
     @dbus.service.method("com.example.SampleInterface",
                          in_signature='', out_signature='(ss)')
@@ -200,6 +216,11 @@ class SomeObject(dbus.service.Object):
     def exampleSignal4(self):
         pass
 
+    @dbus.service.signal("com.example.SampleInterface",
+                         signature='us')
+    def exampleSignal5(self, code, text):
+        pass
+
 if __name__ == '__main__':
     dbus.mainloop.glib.DBusGMainLoop(set_as_default=True)
 
@@ -0,0 +1,486 @@
+/*
+ *  DBusTL - D-Bus Template Library
+ *
+ *  Copyright (C) 2008, 2009  Fabien Chevalier <chefabien@gmail.com>
+ *
+ *
+ *  This file is part of the D-Bus Template Library.
+ *
+ *  The D-Bus Template Library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  D-Bus Template Library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with D-Bus Template Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Drives a D-Bus service with a configurable mix of method calls, 
+ * and reports throughput and latency percentiles.
+ * 
+ * Each connection runs in its own thread, and issues its calls through 
+ * ObjectProxy::asyncCall. In closed loop mode (the default), each connection 
+ * keeps a fixed number of calls in flight. In open loop mode (--rate), calls are 
+ * issued at a fixed arrival rate whatever the service response time, and latencies 
+ * are measured from the time each call was due, so that a stalled service 
+ * shows up in the percentiles instead of just slowing down the load.
+ */
+
+#include <dbustl-1/dbustl>
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+namespace {
+
+unsigned long long monotonicTimeUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Log-linear latency histogram, in the spirit of HdrHistogram: values below 
+ * 2^SubBucketBits are recorded exactly, larger ones with 2^(SubBucketBits - 1) 
+ * buckets per power of two, that is with a relative error below 1.6%.
+ */
+class Histogram {
+    public:
+        Histogram() : _buckets(BucketCount, 0), _count(0), _max(0) {}
+
+        void record(unsigned long long value)
+        {
+            _buckets[index(value)]++;
+            _count++;
+            if(value > _max) {
+                _max = value;
+            }
+        }
+
+        void add(const Histogram& other)
+        {
+            for(int i = 0; i < BucketCount; ++i) {
+                _buckets[i] += other._buckets[i];
+            }
+            _count += other._count;
+            if(other._max > _max) {
+                _max = other._max;
+            }
+        }
+
+        unsigned long long count() const { return _count; }
+
+        unsigned long long max() const { return _max; }
+
+        //Highest value equivalent to the given percentile (0 < percentile <= 100)
+        unsigned long long percentile(double percentile) const
+        {
+            unsigned long long rank = (unsigned long long)(percentile / 100 * _count + 0.5);
+            unsigned long long seen = 0;
+            if(rank == 0) {
+                rank = 1;
+            }
+            for(int i = 0; i < BucketCount; ++i) {
+                seen += _buckets[i];
+                if(seen >= rank) {
+                    unsigned long long value = highestEquivalentValue(i);
+                    return value < _max ? value : _max;
+                }
+            }
+            return _max;
+        }
+
+    private:
+        static const int SubBucketBits = 7;
+        static const int SubBucketCount = 1 << SubBucketBits;
+        static const int SubBucketHalf = SubBucketCount / 2;
+        //Enough for 2^48 microseconds
+        static const int BucketCount = SubBucketCount + (48 - SubBucketBits + 1) * SubBucketHalf;
+
+        static int index(unsigned long long value)
+        {
+            if(value < (unsigned long long)SubBucketCount) {
+                return value;
+            }
+            int shift = 0;
+            while((value >> shift) >= (unsigned long long)SubBucketCount) {
+                ++shift;
+            }
+            int idx = SubBucketCount + (shift - 1) * SubBucketHalf + (int)(value >> shift) - SubBucketHalf;
+            return idx < BucketCount ? idx : BucketCount - 1;
+        }
+
+        static unsigned long long highestEquivalentValue(int idx)
+        {
+            if(idx < SubBucketCount) {
+                return idx;
+            }
+            int shift = (idx - SubBucketCount) / SubBucketHalf + 1;
+            unsigned long long sub = (idx - SubBucketCount) % SubBucketHalf + SubBucketHalf;
+            return ((sub + 1) << shift) - 1;
+        }
+
+        std::vector<unsigned long long> _buckets;
+        unsigned long long _count;
+        unsigned long long _max;
+};
+
+struct MethodSpec {
+    std::string name;
+    unsigned int weight;
+    //Size of the string argument, or 0 for no argument at all
+    unsigned int size;
+    std::string payload;
+};
+
+struct Config {
+    Config() : bus(DBUS_BUS_SESSION), connections(1), concurrency(1), rate(0), duration(10), timeout(-1), totalWeight(0) {}
+    DBusBusType bus;
+    std::string destination;
+    std::string path;
+    std::string interface;
+    std::vector<MethodSpec> methods;
+    unsigned int connections;
+    unsigned int concurrency;
+    //Calls per second for all connections, 0 for closed loop
+    double rate;
+    unsigned int duration;
+    int timeout;
+    unsigned int totalWeight;
+};
+
+class Worker;
+
+struct Completion {
+    Completion(Worker *w, unsigned int m, unsigned long long s) : worker(w), method(m), start(s) {}
+    inline void operator()(dbustl::Message& reply, const dbustl::DBusException& error) const;
+    Worker *worker;
+    unsigned int method;
+    unsigned long long start;
+};
+
+class Worker {
+    public:
+        Worker(const Config& config, unsigned int id) : 
+            _config(config), _conn(config.bus), _proxy(&_conn, config.path, config.destination),
+            _histograms(config.methods.size()), _errors(config.methods.size(), 0),
+            _outstanding(0), _maxOutstanding(0), _end(0), _seed(id + 1)
+        {
+            if(!config.interface.empty()) {
+                _proxy.setInterface(config.interface);
+            }
+            if(config.timeout > 0) {
+                _proxy.setTimeout(config.timeout);
+            }
+        }
+
+        void run(unsigned long long start)
+        {
+            _end = start + (unsigned long long)_config.duration * 1000000;
+            if(_config.rate > 0) {
+                runOpenLoop(start);
+            }
+            else {
+                runClosedLoop();
+            }
+            //Wait for the calls still in flight. Pending calls timeouts need a main loop 
+            //to fire, so watch the time ourselves
+            int timeout = _config.timeout > 0 ? _config.timeout : 25000;
+            unsigned long long deadline = monotonicTimeUs() + (unsigned long long)timeout * 1000;
+            while(_outstanding > 0 && monotonicTimeUs() < deadline 
+                    && dbus_connection_read_write_dispatch(_conn.dbus(), 100)) {
+            }
+        }
+
+        void completed(unsigned int method, unsigned long long start, const dbustl::DBusException& error)
+        {
+            _histograms[method].record(monotonicTimeUs() - start);
+            if(error.isSet()) {
+                _errors[method]++;
+            }
+            _outstanding--;
+            if(_config.rate <= 0 && monotonicTimeUs() < _end) {
+                send(monotonicTimeUs());
+            }
+        }
+
+        const Histogram& histogram(unsigned int method) const { return _histograms[method]; }
+        unsigned long long errors(unsigned int method) const { return _errors[method]; }
+        unsigned long maxOutstanding() const { return _maxOutstanding; }
+
+    private:
+        void runClosedLoop()
+        {
+            for(unsigned int i = 0; i < _config.concurrency; ++i) {
+                send(monotonicTimeUs());
+            }
+            while(monotonicTimeUs() < _end && dbus_connection_read_write_dispatch(_conn.dbus(), 100)) {
+            }
+        }
+
+        void runOpenLoop(unsigned long long start)
+        {
+            double interval = 1000000.0 * _config.connections / _config.rate;
+            double due = start;
+            unsigned long long now;
+
+            while((now = monotonicTimeUs()) < _end) {
+                while(due <= now) {
+                    send((unsigned long long)due);
+                    due += interval;
+                }
+                unsigned long long wait = (unsigned long long)due - now;
+                if(!dbus_connection_read_write_dispatch(_conn.dbus(), wait > 100000 ? 100 : (wait + 999) / 1000)) {
+                    break;
+                }
+            }
+        }
+
+        unsigned int pickMethod()
+        {
+            unsigned int r = rand_r(&_seed) % _config.totalWeight;
+            unsigned int m = 0;
+            while(r >= _config.methods[m].weight) {
+                r -= _config.methods[m].weight;
+                ++m;
+            }
+            return m;
+        }
+
+        //start is the time the call is accounted from
+        void send(unsigned long long start)
+        {
+            unsigned int m = pickMethod();
+            const MethodSpec& spec = _config.methods[m];
+            dbustl::Message call = _proxy.createMethodCall(spec.name);
+            if(spec.size) {
+                call << spec.payload;
+            }
+            _proxy.asyncCall(call, Completion(this, m, start));
+            if(++_outstanding > _maxOutstanding) {
+                _maxOutstanding = _outstanding;
+            }
+        }
+
+        const Config& _config;
+        dbustl::Connection _conn;
+        dbustl::ObjectProxy _proxy;
+        std::vector<Histogram> _histograms;
+        std::vector<unsigned long long> _errors;
+        unsigned long _outstanding;
+        unsigned long _maxOutstanding;
+        unsigned long long _end;
+        unsigned int _seed;
+};
+
+void Completion::operator()(dbustl::Message&, const dbustl::DBusException& error) const
+{
+    worker->completed(method, start, error);
+}
+
+struct ThreadArgs {
+    Worker *worker;
+    unsigned long long start;
+};
+
+void *workerThread(void *data)
+{
+    ThreadArgs *args = static_cast<ThreadArgs *>(data);
+    args->worker->run(args->start);
+    return 0;
+}
+
+bool parseMethod(const char *arg, MethodSpec& spec)
+{
+    std::string s(arg);
+    std::string::size_type colon = s.find(':');
+    spec.name = s.substr(0, colon);
+    spec.weight = 1;
+    spec.size = 0;
+    if(colon != std::string::npos) {
+        std::string::size_type colon2 = s.find(':', colon + 1);
+        spec.weight = atoi(s.substr(colon + 1, colon2 - colon - 1).c_str());
+        if(colon2 != std::string::npos) {
+            spec.size = atoi(s.substr(colon2 + 1).c_str());
+        }
+    }
+    spec.payload.assign(spec.size, 'x');
+    return !spec.name.empty() && spec.weight > 0;
+}
+
+void usage(const char *progname)
+{
+    std::cerr << "Usage: " << progname << " [OPTIONS] -d DESTINATION -p PATH -m METHOD[:WEIGHT[:SIZE]]..." << std::endl
+        << "Calls methods of a D-Bus service as fast as it can take them, or at a fixed rate." << std::endl << std::endl
+        << "  -d, --dest=NAME         bus name of the service" << std::endl
+        << "  -p, --path=PATH         object path" << std::endl
+        << "  -i, --interface=NAME    interface of the methods" << std::endl
+        << "  -m, --method=SPEC       method to call, with a relative WEIGHT in the mix (default 1)," << std::endl
+        << "                          and a string argument of SIZE bytes (default: no argument)." << std::endl
+        << "                          Can be given several times." << std::endl
+        << "  -c, --connections=N     number of connections, each in its own thread (default 1)" << std::endl
+        << "  -C, --concurrency=N     closed loop: calls in flight per connection (default 1)" << std::endl
+        << "  -r, --rate=R            open loop: R calls per second over all connections" << std::endl
+        << "  -D, --duration=S        test duration in seconds (default 10)" << std::endl
+        << "  -t, --timeout=MS        reply timeout in milliseconds (default: D-Bus default)" << std::endl
+        << "      --system            use the system bus instead of the session bus" << std::endl;
+}
+
+void printStats(const std::string& name, const Histogram& h, unsigned long long errors)
+{
+    std::cout << std::left << std::setw(24) << name << std::right 
+        << std::setw(10) << h.count() << std::setw(8) << errors;
+    if(h.count()) {
+        std::cout << std::setw(10) << h.percentile(50) << std::setw(10) << h.percentile(90) 
+            << std::setw(10) << h.percentile(99) << std::setw(10) << h.percentile(99.9)
+            << std::setw(10) << h.percentile(99.99) << std::setw(10) << h.max();
+    }
+    std::cout << std::endl;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option options[] = {
+        { "dest", required_argument, 0, 'd' },
+        { "path", required_argument, 0, 'p' },
+        { "interface", required_argument, 0, 'i' },
+        { "method", required_argument, 0, 'm' },
+        { "connections", required_argument, 0, 'c' },
+        { "concurrency", required_argument, 0, 'C' },
+        { "rate", required_argument, 0, 'r' },
+        { "duration", required_argument, 0, 'D' },
+        { "timeout", required_argument, 0, 't' },
+        { "system", no_argument, 0, 's' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+    Config config;
+    MethodSpec spec;
+    int opt;
+
+    while((opt = getopt_long(argc, argv, "d:p:i:m:c:C:r:D:t:h", options, 0)) != -1) {
+        switch(opt) {
+        case 'd':
+            config.destination = optarg;
+            break;
+        case 'p':
+            config.path = optarg;
+            break;
+        case 'i':
+            config.interface = optarg;
+            break;
+        case 'm':
+            if(!parseMethod(optarg, spec)) {
+                std::cerr << "Invalid method specification: " << optarg << std::endl;
+                return 1;
+            }
+            config.methods.push_back(spec);
+            config.totalWeight += spec.weight;
+            break;
+        case 'c':
+            config.connections = atoi(optarg);
+            break;
+        case 'C':
+            config.concurrency = atoi(optarg);
+            break;
+        case 'r':
+            config.rate = atof(optarg);
+            break;
+        case 'D':
+            config.duration = atoi(optarg);
+            break;
+        case 't':
+            config.timeout = atoi(optarg);
+            break;
+        case 's':
+            config.bus = DBUS_BUS_SYSTEM;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if(optind != argc || config.destination.empty() || config.path.empty() || config.methods.empty()
+            || config.connections == 0 || config.concurrency == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<Worker *> workers;
+    try {
+        for(unsigned int i = 0; i < config.connections; ++i) {
+            workers.push_back(new Worker(config, i));
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::vector<pthread_t> threads(workers.size());
+    std::vector<ThreadArgs> args(workers.size());
+    unsigned long long start = monotonicTimeUs();
+    for(unsigned int i = 0; i < workers.size(); ++i) {
+        args[i].worker = workers[i];
+        args[i].start = start;
+        pthread_create(&threads[i], 0, workerThread, &args[i]);
+    }
+    for(unsigned int i = 0; i < workers.size(); ++i) {
+        pthread_join(threads[i], 0);
+    }
+    unsigned long long elapsed = monotonicTimeUs() - start;
+
+    Histogram all;
+    unsigned long long allErrors = 0;
+    unsigned long maxOutstanding = 0;
+    std::cout << std::left << std::setw(24) << "method" << std::right 
+        << std::setw(10) << "calls" << std::setw(8) << "errors" 
+        << std::setw(10) << "p50(us)" << std::setw(10) << "p90" << std::setw(10) << "p99"
+        << std::setw(10) << "p99.9" << std::setw(10) << "p99.99" << std::setw(10) << "max" << std::endl;
+    for(unsigned int m = 0; m < config.methods.size(); ++m) {
+        Histogram h;
+        unsigned long long errors = 0;
+        for(unsigned int i = 0; i < workers.size(); ++i) {
+            h.add(workers[i]->histogram(m));
+            errors += workers[i]->errors(m);
+        }
+        printStats(config.methods[m].name, h, errors);
+        all.add(h);
+        allErrors += errors;
+    }
+    if(config.methods.size() > 1) {
+        printStats("(all)", all, allErrors);
+    }
+    for(unsigned int i = 0; i < workers.size(); ++i) {
+        if(workers[i]->maxOutstanding() > maxOutstanding) {
+            maxOutstanding = workers[i]->maxOutstanding();
+        }
+        delete workers[i];
+    }
+
+    std::cout << std::endl << all.count() << " calls in " << elapsed / 1000 << "ms: " 
+        << std::fixed << std::setprecision(1) << all.count() * 1000000.0 / elapsed << " calls/s";
+    if(config.rate > 0) {
+        std::cout << " (target " << config.rate << "), up to " << maxOutstanding << " calls in flight per connection";
+    }
+    std::cout << std::endl;
+    return allErrors ? 2 : 0;
+}
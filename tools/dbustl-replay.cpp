@@ -0,0 +1,263 @@
+/*
+ *  DBusTL - D-Bus Template Library
+ *
+ *  Copyright (C) 2008, 2009  Fabien Chevalier <chefabien@gmail.com>
+ *
+ *
+ *  This file is part of the D-Bus Template Library.
+ *
+ *  The D-Bus Template Library is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  D-Bus Template Library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with D-Bus Template Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Replays the method calls recorded in a traffic log 
+ * (see Connection::startRecording()) against a running service, 
+ * and reports per method latencies.
+ */
+
+#include <dbustl-1/MessageLog>
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <map>
+
+#include <cstdlib>
+#include <getopt.h>
+#include <time.h>
+
+namespace {
+
+struct MethodStats {
+    MethodStats() : calls(0), errors(0), total(0), min(~0ULL), max(0) {}
+    unsigned long calls;
+    unsigned long errors;
+    unsigned long long total;
+    unsigned long long min;
+    unsigned long long max;
+};
+
+struct PendingReplay {
+    std::map<std::string, MethodStats> *stats;
+    std::string method;
+    unsigned long long sentAt;
+    unsigned long *outstanding;
+};
+
+unsigned long long monotonicTimeUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void replyReceived(DBusPendingCall *pending, void *user_data)
+{
+    PendingReplay *replay = static_cast<PendingReplay *>(user_data);
+    unsigned long long latency = monotonicTimeUs() - replay->sentAt;
+    MethodStats& stats = (*replay->stats)[replay->method];
+    DBusMessage *reply = dbus_pending_call_steal_reply(pending);
+
+    stats.calls++;
+    if(!reply || dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR) {
+        stats.errors++;
+    }
+    stats.total += latency;
+    if(latency < stats.min) {
+        stats.min = latency;
+    }
+    if(latency > stats.max) {
+        stats.max = latency;
+    }
+    if(reply) {
+        dbus_message_unref(reply);
+    }
+    (*replay->outstanding)--;
+}
+
+void pendingReplayDelete(void *user_data)
+{
+    delete static_cast<PendingReplay *>(user_data);
+}
+
+void usage(const char *progname)
+{
+    std::cerr << "Usage: " << progname << " [OPTIONS] LOGFILE" << std::endl
+        << "Replays the method calls sent in a dbustl traffic log." << std::endl << std::endl
+        << "  -a, --address=ADDRESS   bus to replay on (default: session bus)" << std::endl
+        << "  -d, --dest=NAME         send all calls to NAME instead of the recorded destination" << std::endl
+        << "  -f, --fast              replay as fast as possible instead of at the recorded pace" << std::endl
+        << "  -t, --timeout=MS        reply timeout in milliseconds (default: 25000)" << std::endl;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option options[] = {
+        { "address", required_argument, 0, 'a' },
+        { "dest", required_argument, 0, 'd' },
+        { "fast", no_argument, 0, 'f' },
+        { "timeout", required_argument, 0, 't' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+    const char *address = 0;
+    const char *dest = 0;
+    bool fast = false;
+    int timeout = 25000;
+    int opt;
+
+    while((opt = getopt_long(argc, argv, "a:d:ft:h", options, 0)) != -1) {
+        switch(opt) {
+        case 'a':
+            address = optarg;
+            break;
+        case 'd':
+            dest = optarg;
+            break;
+        case 'f':
+            fast = true;
+            break;
+        case 't':
+            timeout = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if(optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    dbustl::MessageLogReader log;
+    if(!log.open(argv[optind])) {
+        std::cerr << argv[optind] << ": not a dbustl traffic log" << std::endl;
+        return 1;
+    }
+
+    DBusError error;
+    DBusConnection *conn;
+    dbus_error_init(&error);
+    if(address) {
+        conn = dbus_connection_open_private(address, &error);
+        if(conn && !dbus_bus_register(conn, &error)) {
+            dbus_connection_close(conn);
+            dbus_connection_unref(conn);
+            conn = 0;
+        }
+    }
+    else {
+        conn = dbus_bus_get_private(DBUS_BUS_SESSION, &error);
+    }
+    if(!conn) {
+        std::cerr << "Unable to connect to bus: " << error.message << std::endl;
+        dbus_error_free(&error);
+        return 1;
+    }
+    dbus_connection_set_exit_on_disconnect(conn, FALSE);
+
+    std::map<std::string, MethodStats> stats;
+    unsigned long outstanding = 0;
+    unsigned long long firstTimestamp = 0;
+    bool first = true;
+    unsigned long long start = monotonicTimeUs();
+    dbustl::MessageLogReader::Entry entry;
+
+    while(log.next(entry)) {
+        if(!entry.sent || dbus_message_get_type(entry.message) != DBUS_MESSAGE_TYPE_METHOD_CALL) {
+            dbus_message_unref(entry.message);
+            continue;
+        }
+        if(first) {
+            firstTimestamp = entry.timestamp;
+            first = false;
+        }
+
+        //Wait for the recorded time, processing replies in the meantime
+        if(!fast) {
+            unsigned long long due = start + (entry.timestamp - firstTimestamp);
+            unsigned long long now;
+            while((now = monotonicTimeUs()) < due) {
+                dbus_connection_read_write_dispatch(conn, (due - now + 999) / 1000);
+            }
+        }
+
+        //The copy gets a fresh serial once sent
+        DBusMessage *call = dbus_message_copy(entry.message);
+        dbus_message_unref(entry.message);
+        if(!call) {
+            std::cerr << "Out of memory" << std::endl;
+            return 1;
+        }
+        dbus_message_set_sender(call, NULL);
+        if(dest) {
+            dbus_message_set_destination(call, dest);
+        }
+
+        PendingReplay *replay = new PendingReplay;
+        const char *intf = dbus_message_get_interface(call);
+        replay->stats = &stats;
+        replay->method = intf ? std::string(intf) + "." + dbus_message_get_member(call) : dbus_message_get_member(call);
+        replay->outstanding = &outstanding;
+
+        DBusPendingCall *pending;
+        replay->sentAt = monotonicTimeUs();
+        if(!dbus_connection_send_with_reply(conn, call, &pending, timeout) || !pending) {
+            std::cerr << "Unable to send " << replay->method << std::endl;
+            delete replay;
+            dbus_message_unref(call);
+            break;
+        }
+        outstanding++;
+        dbus_pending_call_set_notify(pending, replyReceived, replay, pendingReplayDelete);
+        dbus_pending_call_unref(pending);
+        dbus_message_unref(call);
+
+        //Don't let replies pile up in fast mode
+        dbus_connection_read_write_dispatch(conn, 0);
+    }
+
+    //Pending calls timeouts need a main loop to fire, so watch the time ourselves
+    unsigned long long deadline = monotonicTimeUs() + (unsigned long long)timeout * 1000;
+    while(outstanding > 0 && monotonicTimeUs() < deadline 
+            && dbus_connection_read_write_dispatch(conn, 100)) {
+    }
+    unsigned long long elapsed = monotonicTimeUs() - start;
+
+    std::cout << std::left << std::setw(40) << "method" << std::right 
+        << std::setw(8) << "calls" << std::setw(8) << "errors" 
+        << std::setw(12) << "min(us)" << std::setw(12) << "avg(us)" << std::setw(12) << "max(us)" << std::endl;
+    unsigned long total = 0;
+    for(std::map<std::string, MethodStats>::const_iterator it = stats.begin(); it != stats.end(); ++it) {
+        const MethodStats& s = it->second;
+        total += s.calls;
+        std::cout << std::left << std::setw(40) << it->first << std::right 
+            << std::setw(8) << s.calls << std::setw(8) << s.errors 
+            << std::setw(12) << s.min << std::setw(12) << s.total / s.calls << std::setw(12) << s.max << std::endl;
+    }
+    std::cout << std::endl << total << " calls replayed in " << elapsed / 1000 << "ms";
+    if(outstanding) {
+        std::cout << ", " << outstanding << " still unanswered";
+    }
+    std::cout << std::endl;
+
+    dbus_connection_close(conn);
+    dbus_connection_unref(conn);
+    return outstanding ? 2 : 0;
+}